@@ -11,6 +11,9 @@
  */
 
 #include "in4073.h"
+#include "profile.h"
+
+int16_t ae[4];
 
 void update_motors(void)
 {								
@@ -22,8 +25,17 @@ void update_motors(void)
 
 void run_filters_and_control()
 {
+	PROFILE_BEGIN(PROFILE_FILTER);
 	// fancy stuff here
 	// control loops and/or filters
+	PROFILE_END(PROFILE_FILTER);
+
+	PROFILE_BEGIN(PROFILE_MOTORS);
 	update_motors();
+	PROFILE_END(PROFILE_MOTORS);
+
+	PROFILE_BEGIN(PROFILE_TELEMETRY);
+	write_flight_data();
+	PROFILE_END(PROFILE_TELEMETRY);
 }
 
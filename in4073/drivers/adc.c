@@ -10,10 +10,14 @@
  */
 
 #include "in4073.h"
+#include "app_scheduler.h"
+#include "isr_stats.h"
 
 //#define BATTERY_VOLTAGE 4 //these are AIN, not ports p0.01 = ain2
 //#define BATTERY_AMPERAGE 2
 
+uint16_t bat_volt;
+
 void adc_request_sample(void)
 {
 	if (!NRF_ADC->BUSY) NRF_ADC->TASKS_START = 1;
@@ -21,8 +25,13 @@ void adc_request_sample(void)
 
 void ADC_IRQHandler(void)
 {
+    ISR_ENTER(ISR_ADC);
+
     NRF_ADC->EVENTS_END = 0;
     bat_volt = NRF_ADC -> RESULT*7; // Battery voltage = (result*1.2*3/255*2) = RESULT*0.007058824
+    //checked in the main loop, the queue being full only drops this check
+    app_sched_event_put((void *)&bat_volt, sizeof(bat_volt), battery_sampled);
+    ISR_EXIT(ISR_ADC);
 }
 
 void adc_init(void)
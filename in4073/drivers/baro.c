@@ -23,16 +23,15 @@ static uint8_t loop_count = 0;
 uint32_t D1, D2;	
 static uint8_t data[3] = {0};
 uint32_t initTime = 0;
+int32_t pressure;
+int32_t temperature;
 
 void read_baro(void)
 {
 
 	if(loop_count==0)
 	{
-		NRF_TWI0->ADDRESS = MS5611_ADDR;
-		NRF_TWI0->SHORTS = TWI_SHORTS_BB_STOP_Msk;
-		NRF_TWI0->TXD = CONVERT_D1_4096;
-		NRF_TWI0->TASKS_STARTTX = 1;
+		i2c_command(MS5611_ADDR, CONVERT_D1_4096);
 
 		loop_count = 1;
 		initTime = get_time_us();
@@ -43,10 +42,7 @@ void read_baro(void)
 		i2c_read(MS5611_ADDR, READ, 3, data);
 		D1 = (uint32_t) ((data[0] << 16)|(data[1] << 8)|data[2]);
 
-		NRF_TWI0->ADDRESS = MS5611_ADDR;
-		NRF_TWI0->SHORTS = TWI_SHORTS_BB_STOP_Msk;
-		NRF_TWI0->TXD = CONVERT_D2_1024;
-		NRF_TWI0->TASKS_STARTTX = 1;
+		i2c_command(MS5611_ADDR, CONVERT_D2_1024);
 
 		loop_count = 2;
 		initTime = get_time_us();
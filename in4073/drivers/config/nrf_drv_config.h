@@ -322,11 +322,11 @@
 #endif
 
 /* WDT */
-#define WDT_ENABLED 0
+#define WDT_ENABLED 1
 
 #if (WDT_ENABLED == 1)
 #define WDT_CONFIG_BEHAVIOUR     NRF_WDT_BEHAVIOUR_RUN_SLEEP
-#define WDT_CONFIG_RELOAD_VALUE  2000
+#define WDT_CONFIG_RELOAD_VALUE  1000
 #define WDT_CONFIG_IRQ_PRIORITY  APP_IRQ_PRIORITY_HIGH
 #endif
 
@@ -9,6 +9,7 @@
  */
 
 #include "in4073.h"
+#include "isr_stats.h"
 
 static bool sensor_int_flag = false;
 
@@ -42,11 +43,15 @@ void gpio_init(void)
 
 void GPIOTE_IRQHandler(void)
 {
+	ISR_ENTER(ISR_GPIOTE);
+
 	if(NRF_GPIOTE->EVENTS_IN[0] != 0)
 	{
 		NRF_GPIOTE->EVENTS_IN[0] = 0;
 		sensor_int_flag = true;
         }
+
+	ISR_EXIT(ISR_GPIOTE);
 }
 
 
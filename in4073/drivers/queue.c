@@ -15,10 +15,15 @@ void init_queue(queue *q){
 	q->first = 0;
 	q->last = QUEUE_SIZE - 1;
 	q->count = 0;
+	q->overruns = 0;
 }
 
 void enqueue(queue *q,char x){
 
+	if (q->count == QUEUE_SIZE) {
+		q->overruns += 1;
+		return;
+	}
 	q->last = (q->last + 1) % QUEUE_SIZE;
 	q->Data[ q->last ] = x;
 	q->count += 1;
@@ -12,6 +12,7 @@
 #include <stdint.h>
 #include <string.h>
 #include "in4073.h"
+#include "isr_stats.h"
 
 #define SPI_CS		17
 #define SPI_MISO	18
@@ -28,7 +29,20 @@
 #define WREN            0x06
 #define EWSR            0x50
 #define CHIP_ERASE      0x60
+#define SECTOR_ERASE    0x20
 #define AAI             0xAF 
+#define AAI_WORD        0xAD    // word-AAI, only on the SST25VFxxxB parts
+
+#define STATUS_BUSY     0x01
+
+#define FLASH_SIZE      0x20000
+#define FLASH_PAGE_SIZE 256
+#define FLASH_NO_PAGE   0xFFFFFFFF
+
+// worst case times from the datasheet, with some margin
+#define FLASH_BYTE_TIMEOUT_US           100
+#define FLASH_SECTOR_ERASE_TIMEOUT_US   50000
+#define FLASH_CHIP_ERASE_TIMEOUT_US     200000
 
 #define SPI_FREQ_4MBPS        0x40
 #define SPI_MODULE            0x01
@@ -83,290 +97,352 @@ uint32_t* spi_master_init(uint8_t spi_num, SPI_config_t *spi_config)
     spi_base[spi_num]->CONFIG = spi_config->config.SPI_cfg;
 
     spi_base[spi_num]->EVENTS_READY = 0;
+    spi_base[spi_num]->INTENSET = SPI_INTENSET_READY_Msk;
     /* Enable */
     spi_base[spi_num]->ENABLE = (SPI_ENABLE_ENABLE_Enabled << SPI_ENABLE_ENABLE_Pos);
 
+    /* the transfer queue only runs on SPI1 */
+    if(spi_num == SPI_MODULE)
+    {
+        NVIC_ClearPendingIRQ(SPI1_TWI1_IRQn);
+        NVIC_SetPriority(SPI1_TWI1_IRQn, 3);
+        NVIC_EnableIRQ(SPI1_TWI1_IRQn);
+    }
+
     return (uint32_t *)spi_base[spi_num];
 }
 
-bool spi_master_tx_rx(uint8_t spi_num, uint16_t transfer_size, const uint8_t *tx_data, uint8_t *rx_data)
-{
-    volatile uint32_t *SPI_DATA_READY;
-    uint32_t tmp; 
-    if(tx_data == 0 || rx_data == 0)
-    {
-        return false;
-    }
-    if(transfer_size < 1)
-	{
-		return false;
-	}
-    SPI = spi_base[spi_num];
-    SPI_DATA_READY = &SPI->EVENTS_READY;
-    /* enable slave (slave select active low) */
-    nrf_gpio_pin_clear(spi_config_table[spi_num].pin_CSN);
-    
-    *SPI_DATA_READY = 0; 
-    
-    SPI->TXD = (uint32_t)*tx_data++;
-    tmp = (uint32_t)*tx_data++;
-    while(--transfer_size)
-    {
-        SPI->TXD =  tmp;
-        tmp = (uint32_t)*tx_data++;
-        
-        /* Wait for the transaction complete or timeout (about 10ms - 20 ms) */
-        while (*SPI_DATA_READY == 0);
-
-        /* clear the event to be ready to receive next messages */
-        *SPI_DATA_READY = 0;
-        
-        *rx_data++ = SPI->RXD; 
-    }
-      
-    /* Wait for the transaction complete or timeout (about 10ms - 20 ms) */
-    while (*SPI_DATA_READY == 0);
+/*------------------------------------------------------------------
+ * transfer queue. SPI1 has no DMA, so the interrupt moves the bytes
+ * of the transfer at the head of the queue one READY event at a time
+ * (two in flight, TXD is double buffered) and the caller gets on with
+ * its work meanwhile. chip select is dropped for each transfer and
+ * its callback runs from the interrupt once the chip is released.
+ *------------------------------------------------------------------
+ */
+#define SPI_QUEUE_SIZE  8
 
-    *rx_data = SPI->RXD;
+static spi_transfer_t *spi_queue_slots[SPI_QUEUE_SIZE];
+static volatile uint8_t spi_head;
+static volatile uint8_t spi_count;
+static spi_transfer_t *volatile spi_active;
+static uint32_t spi_sent;       // bytes of spi_active written to TXD
+static uint32_t spi_received;   // and read back from RXD
+static uint32_t spi_start_us;
 
-    /* disable slave (slave select active low) */
-    nrf_gpio_pin_set(spi_config_table[spi_num].pin_CSN);
+static inline uint32_t spi_length(const spi_transfer_t *t)
+{
+    return t->command_length + t->length;
+}
 
-    return true;
+static inline uint8_t spi_byte(const spi_transfer_t *t, uint32_t i)
+{
+    if(i < t->command_length)
+    {
+        return t->command[i];
+    }
+    return t->tx ? t->tx[i - t->command_length] : 0x00;
 }
 
-bool spi_master_tx(uint8_t spi_num, uint16_t transfer_size, const uint8_t *tx_data)
+/* starts the next transfer if the bus is free, with the interrupt disabled or from it */
+static void spi_start(void)
 {
-    volatile uint32_t dummyread;
-    
-    if(tx_data == 0)
+    spi_transfer_t *t;
+
+    if(spi_active != 0 || spi_count == 0)
     {
-        return false;
+        return;
     }
-    if(transfer_size < 1)
-	{
-		return false;
-	}
-	
-    SPI = spi_base[spi_num];
-    
+    t = spi_queue_slots[spi_head];
+    spi_head = (spi_head + 1) % SPI_QUEUE_SIZE;
+    spi_count--;
+
+    spi_active = t;
+    spi_sent = 0;
+    spi_received = 0;
+    spi_start_us = get_time_us();
+
+    SPI = spi_base[SPI_MODULE];
     /* enable slave (slave select active low) */
-    nrf_gpio_pin_clear(spi_config_table[spi_num].pin_CSN);
-    
-    SPI->EVENTS_READY = 0; 
-    
-    SPI->TXD = (uint32_t)*tx_data++;
-    
-    while(--transfer_size)
+    nrf_gpio_pin_clear(spi_config_table[SPI_MODULE].pin_CSN);
+    SPI->EVENTS_READY = 0;
+    SPI->TXD = (uint32_t)spi_byte(t, spi_sent++);
+    if(spi_sent < spi_length(t) && !(t->flags & SPI_POLL_READY))
     {
-        SPI->TXD =  (uint32_t)*tx_data++;
-
-        /* Wait for the transaction complete or timeout (about 10ms - 20 ms) */
-        while (SPI->EVENTS_READY == 0);
-        
-        /* clear the event to be ready to receive next messages */
-        SPI->EVENTS_READY = 0;
-        
-        dummyread = SPI->RXD;
+        SPI->TXD = (uint32_t)spi_byte(t, spi_sent++);
     }
-    
-    /* Wait for the transaction complete or timeout (about 10ms - 20 ms) */
-    while (SPI->EVENTS_READY == 0);
+}
 
-    dummyread = SPI->RXD;
+static void spi_finish(uint8_t state)
+{
+    spi_transfer_t *t = spi_active;
 
     /* disable slave (slave select active low) */
-    nrf_gpio_pin_set(spi_config_table[spi_num].pin_CSN);
-    
-    dummyread++;
-    return true;
+    nrf_gpio_pin_set(spi_config_table[SPI_MODULE].pin_CSN);
+    spi_active = 0;
+    t->state = state;
+    if(t->callback)
+    {
+        t->callback(t);
+    }
+    spi_start();
 }
 
-bool spi_master_rx(uint8_t spi_num, uint16_t transfer_size, uint8_t *rx_data)
+void SPI1_TWI1_IRQHandler(void)
 {
-    if(rx_data == 0)
+    spi_transfer_t *t = spi_active;
+    uint8_t data;
+    ISR_ENTER(ISR_SPI1);
+
+    if(NRF_SPI1->EVENTS_READY == 0)
     {
-        return false;
+        ISR_EXIT(ISR_SPI1);
+        return;
     }
-    if(transfer_size < 1)
-	{
-		return false;
-	}
-    SPI = spi_base[spi_num];
-    
-    /* enable slave (slave select active low) */
-    nrf_gpio_pin_clear(spi_config_table[spi_num].pin_CSN);
-
-    SPI->EVENTS_READY = 0; 
-    
-    SPI->TXD = 0;
-    
-    while(--transfer_size)
+    NRF_SPI1->EVENTS_READY = 0;
+    data = NRF_SPI1->RXD;
+    if(t == 0)
     {
-        SPI->TXD = 0;
-
-        /* Wait for the transaction complete or timeout (about 10ms - 20 ms) */
-        while (SPI->EVENTS_READY == 0);
-        
-        /* clear the event to be ready to receive next messages */
-        SPI->EVENTS_READY = 0;
-        
-        *rx_data++ = SPI->RXD;
+        ISR_EXIT(ISR_SPI1);
+        return;
     }
-    
-    /* Wait for the transaction complete or timeout (about 10ms - 20 ms) */
-    while (SPI->EVENTS_READY == 0);
 
-    *rx_data = SPI->RXD;
+    if(spi_received >= t->command_length && spi_received < spi_length(t) && t->rx)
+    {
+        t->rx[spi_received - t->command_length] = data;
+    }
+    spi_received++;
 
-    /* disable slave (slave select active low) */
-    nrf_gpio_pin_set(spi_config_table[spi_num].pin_CSN);
+    if(t->flags & SPI_POLL_READY)
+    {
+        //the chip clocks out its status for as long as chip select is low
+        if(spi_received > t->command_length)
+        {
+            if((data & STATUS_BUSY) == 0)
+            {
+                spi_finish(SPI_DONE);
+                ISR_EXIT(ISR_SPI1);
+                return;
+            }
+            if(get_time_us() - spi_start_us >= t->timeout_us)
+            {
+                spi_finish(SPI_FAILED);
+                ISR_EXIT(ISR_SPI1);
+                return;
+            }
+        }
+        NRF_SPI1->TXD = (uint32_t)spi_byte(t, spi_sent++);
+        ISR_EXIT(ISR_SPI1);
+        return;
+    }
 
-    return true;
+    if(spi_sent < spi_length(t))
+    {
+        NRF_SPI1->TXD = (uint32_t)spi_byte(t, spi_sent++);
+    }
+    else if(spi_received == spi_length(t))
+    {
+        spi_finish(SPI_DONE);
+    }
+    ISR_EXIT(ISR_SPI1);
 }
 
-bool spi_master_tx_rx_fast_read(uint8_t spi_num, uint16_t transfer_size, const uint8_t *tx_data, uint8_t *rx_data)
+/**
+ * Appends a transfer to the queue and starts it if the bus is free. The transfer must stay in place until
+ * its state is no longer SPI_QUEUED. Can be called from a callback.
+ *
+ * @param t the transfer, command and command_length at least must be filled in.
+ * @return
+ * @retval true if the transfer is queued.
+ * @retval false if the queue is full.
+ */
+bool spi_queue(spi_transfer_t *t)
 {
-    volatile uint32_t dummyread;
-	
-    if(tx_data == 0 || rx_data == 0)
+    bool queued = false;
+
+    if(t->command_length < 1 || t->command_length > SPI_COMMAND_MAX)
     {
+        t->state = SPI_FAILED;
         return false;
     }
-    if(transfer_size < 1)
-	{
-		return false;
-	}
-    SPI = spi_base[spi_num];
-    
-    /* enable slave (slave select active low) */
-    nrf_gpio_pin_clear(spi_config_table[spi_num].pin_CSN);
-
-    SPI->EVENTS_READY = 0; 
+    t->state = SPI_QUEUED;
 
-	for(int i=0; i<4; i++)
-	{
-		SPI->TXD = (uint32_t)*tx_data++;
-		while (SPI->EVENTS_READY == 0);		
-		SPI->EVENTS_READY = 0;
-		dummyread = SPI->RXD;
+    NVIC_DisableIRQ(SPI1_TWI1_IRQn);
+    if(spi_count < SPI_QUEUE_SIZE)
+    {
+        spi_queue_slots[(spi_head + spi_count) % SPI_QUEUE_SIZE] = t;
+        spi_count++;
+        queued = true;
+        spi_start();
     }
+    NVIC_EnableIRQ(SPI1_TWI1_IRQn);
 
-    while(transfer_size--)
+    if(!queued)
     {
-        SPI->TXD =  0x00;
-
-        /* Wait for the transaction complete or timeout (about 10ms - 20 ms) */
-        while (SPI->EVENTS_READY == 0);
-
-        /* clear the event to be ready to receive next messages */
-        SPI->EVENTS_READY = 0;
-        *rx_data++ = SPI->RXD; 
+        t->state = SPI_FAILED;
     }
-
-    /* disable slave (slave select active low) */
-    nrf_gpio_pin_set(spi_config_table[spi_num].pin_CSN);
-    
-	dummyread++;
-    return true;
+    return queued;
 }
 
-bool spi_master_tx_rx_fast_write(uint8_t spi_num, uint16_t transfer_size, const uint8_t *tx_data, uint8_t *bytes)
+/*------------------------------------------------------------------
+ * background AAI write, see flash_write_start(). one transfer is
+ * requeued from its own callback for each step: WREN, AAI with the
+ * address and first byte, then a status poll after every AAI, an
+ * AAI with each next byte and WRDI once the last one is programmed.
+ *------------------------------------------------------------------
+ */
+#define FLASH_JOB_WREN  0
+#define FLASH_JOB_AAI   1
+#define FLASH_JOB_POLL  2
+#define FLASH_JOB_WRDI  3
+
+static struct {
+    spi_transfer_t step;
+    const uint8_t *data;
+    uint32_t address;
+    uint32_t left;
+    uint8_t phase;
+    bool ok;
+    void (*done)(bool ok);
+    volatile bool active;
+} flash_job;
+
+#ifndef FLASH_AAI_WORD
+static void flash_job_step(spi_transfer_t *t)
 {
-    volatile uint32_t dummyread;
-	uint32_t bytesWritten = 0;
-	uint32_t address = tx_data[3] + (tx_data[2]<<8) + (tx_data[1]<<16);
-	
-    if(tx_data == 0 || bytes == 0)
+    void (*done)(bool ok);
+
+    if(t->state != SPI_DONE && flash_job.phase != FLASH_JOB_WRDI)
     {
-        return false;
+        //the chip may be left in AAI mode, WRDI ends it
+        flash_job.ok = false;
+        flash_job.phase = FLASH_JOB_POLL;
+        flash_job.left = 0;
     }
-    if(transfer_size < 1)
-	{
-		return false;
-	}
-    SPI = spi_base[spi_num];
-    
-    /* enable slave (slave select active low) */
-    nrf_gpio_pin_clear(spi_config_table[spi_num].pin_CSN);
 
-    SPI->EVENTS_READY = 0; 
+    switch(flash_job.phase)
+    {
+    case FLASH_JOB_WREN:
+        t->command[0] = AAI;
+        t->command[1] = (flash_job.address & 0xFFFFFF) >> 16;
+        t->command[2] = (flash_job.address & 0xFFFF) >> 8;
+        t->command[3] = flash_job.address & 0xFF;
+        t->command[4] = *flash_job.data++;
+        t->command_length = 5;
+        flash_job.left--;
+        flash_job.phase = FLASH_JOB_AAI;
+        break;
+    case FLASH_JOB_AAI:
+        t->command[0] = RDSR;
+        t->command_length = 1;
+        t->flags = SPI_POLL_READY;
+        t->timeout_us = FLASH_BYTE_TIMEOUT_US;
+        flash_job.phase = FLASH_JOB_POLL;
+        break;
+    case FLASH_JOB_POLL:
+        if(flash_job.left == 0)
+        {
+            t->command[0] = WRDI;
+            t->command_length = 1;
+            t->flags = 0;
+            flash_job.phase = FLASH_JOB_WRDI;
+            break;
+        }
+        t->command[0] = AAI;
+        t->command[1] = *flash_job.data++;
+        t->command_length = 2;
+        t->flags = 0;
+        flash_job.left--;
+        flash_job.phase = FLASH_JOB_AAI;
+        break;
+    default:
+        if(t->state != SPI_DONE)
+        {
+            flash_job.ok = false;
+        }
+        done = flash_job.done;
+        flash_job.active = false;
+        if(done)
+        {
+            done(flash_job.ok);
+        }
+        return;
+    }
 
-	for(int i=0; i<4; i++)
-	{
-		SPI->TXD = (uint32_t)*tx_data++;
-		while (SPI->EVENTS_READY == 0);		
-		SPI->EVENTS_READY = 0;
-		dummyread = SPI->RXD;
+    if(!spi_queue(t))
+    {
+        flash_job.ok = false;
+        flash_job.active = false;
+        if(flash_job.done)
+        {
+            flash_job.done(false);
+        }
     }
+}
+#endif
 
-	//Send first byte
-	SPI->TXD = (uint32_t)*bytes++;
-	while (SPI->EVENTS_READY == 0);
-	SPI->EVENTS_READY = 0;
-	dummyread = SPI->RXD;
-	
-	/* disable slave (slave select active low) */
-	nrf_gpio_pin_set(spi_config_table[spi_num].pin_CSN);
+/**
+ * Checks for a background write started by flash_write_start().
+ *
+ * @return
+ * @retval true if the write is still running.
+ * @retval false if the chip is free for the next operation.
+ */
+bool flash_write_pending(void)
+{
+    return flash_job.active;
+}
+
+/*------------------------------------------------------------------
+ * runs one transfer to completion for the synchronous flash_*()
+ * calls. not from an interrupt, the queue would never get to it.
+ *------------------------------------------------------------------
+ */
+static bool flash_transfer(spi_transfer_t *t)
+{
+    //the chip only takes AAI, RDSR and WRDI while a write is going on
+    while (flash_job.active);
 
-	while(--transfer_size)
+    if(!spi_queue(t))
     {
-		nrf_delay_us(20);
-		
-		/* enable slave (slave select active low) */
-        nrf_gpio_pin_clear(spi_config_table[spi_num].pin_CSN);
-		
-		//Send AAI
-		SPI->TXD = (uint32_t)AAI;
-
-        /* Wait for the transaction complete or timeout (about 10ms - 20 ms) */
-        while (SPI->EVENTS_READY == 0);
-
-        /* clear the event to be ready to receive next messages */
-        SPI->EVENTS_READY = 0;
-        dummyread = SPI->RXD; 
-	
-        SPI->TXD = (uint32_t)*bytes++;
-
-        /* Wait for the transaction complete or timeout (about 10ms - 20 ms) */
-        while (SPI->EVENTS_READY == 0);
-
-        /* clear the event to be ready to receive next messages */
-        SPI->EVENTS_READY = 0;
-        dummyread = SPI->RXD; 
-		
-		bytesWritten++;
-		/* disable slave (slave select active low) */
-        nrf_gpio_pin_set(spi_config_table[spi_num].pin_CSN);
-		if(address + bytesWritten >= 0x1FFFF)
-		{
-			if(transfer_size)
-			{
-				return false;
-			}
-		}
+        return false;
     }
+    while (t->state == SPI_QUEUED);
+    return t->state == SPI_DONE;
+}
 
-	nrf_delay_us(20);
-
-	/* enable slave (slave select active low) */
-    nrf_gpio_pin_clear(spi_config_table[spi_num].pin_CSN);
-	
-	//Send WRDI
-	SPI->TXD = (uint32_t)WRDI;
+/**
+ * Polls the BUSY bit until the current program or erase operation is done. RDSR is sent once,
+ * after that the chip keeps clocking out its status for as long as chip select stays low.
+ *
+ * @param timeout_us give up after this many microseconds.
+ * @return
+ * @retval true if the chip is ready.
+ * @retval false if the operation did not finish in time.
+ */
+bool flash_wait_ready(uint32_t timeout_us)
+{
+    spi_transfer_t t = {.command = {RDSR}, .command_length = 1, .flags = SPI_POLL_READY, .timeout_us = timeout_us};
+    return flash_transfer(&t);
+}
 
-    /* Wait for the transaction complete or timeout (about 10ms - 20 ms) */
-    while (SPI->EVENTS_READY == 0);
+/*------------------------------------------------------------------
+ * read cache, one page read with a single READ command. sequential
+ * readers get the rest of the page from RAM instead of paying for
+ * the command and address again on every call.
+ *------------------------------------------------------------------
+ */
+static uint8_t flash_page[FLASH_PAGE_SIZE];
+static uint32_t flash_page_address = FLASH_NO_PAGE;
 
-    /* clear the event to be ready to receive next messages */
-    SPI->EVENTS_READY = 0;
-    dummyread = SPI->RXD; 
-		
-    /* disable slave (slave select active low) */
-    nrf_gpio_pin_set(spi_config_table[spi_num].pin_CSN);
-    
-	dummyread++;
-    return true;
+/* forgets the cached page if it overlaps what is being written or erased */
+static void flash_cache_drop(uint32_t address, uint32_t count)
+{
+    if(flash_page_address != FLASH_NO_PAGE && address < flash_page_address + FLASH_PAGE_SIZE &&
+        address + count > flash_page_address)
+    {
+        flash_page_address = FLASH_NO_PAGE;
+    }
 }
 
 /**
@@ -378,8 +454,8 @@ bool spi_master_tx_rx_fast_write(uint8_t spi_num, uint16_t transfer_size, const
  */
 bool flash_write_enable(void)
 {
-	uint8_t tx_data = WREN;
-	return spi_master_tx(SPI_MODULE, 1, &tx_data);
+	spi_transfer_t t = {.command = {WREN}, .command_length = 1};
+	return flash_transfer(&t);
 }
 
 /**
@@ -391,8 +467,8 @@ bool flash_write_enable(void)
  */
 bool flash_write_disable(void)
 {
-	uint8_t tx_data = WRDI;
-	return spi_master_tx(SPI_MODULE, 1, &tx_data);
+	spi_transfer_t t = {.command = {WRDI}, .command_length = 1};
+	return flash_transfer(&t);
 }
 
 /**
@@ -404,14 +480,54 @@ bool flash_write_disable(void)
  */
 bool flash_chip_erase(void)
 {
-	uint8_t tx_data = CHIP_ERASE;
+	spi_transfer_t t = {.command = {CHIP_ERASE}, .command_length = 1};
+	flash_cache_drop(0, FLASH_SIZE);
+	if(!flash_write_enable())
+	{
+		return false;
+	}
+	if(!flash_transfer(&t))
+	{
+		return false;
+	}
+	return flash_wait_ready(FLASH_CHIP_ERASE_TIMEOUT_US);
+}
+
+/**
+ * Clears the 4 KB sector containing the given address by setting it to 0xFF.
+ *
+ * @param address any address inside the sector.
+ * @return
+ * @retval true if operation is successful.
+ * @retval false if operation is failed.
+ */
+bool flash_sector_erase(uint32_t address)
+{
+	if(!flash_sector_erase_start(address))
+	{
+		return false;
+	}
+	return flash_wait_ready(FLASH_SECTOR_ERASE_TIMEOUT_US);
+}
+
+/**
+ * Starts erasing the 4 KB sector containing the given address and returns right away. The chip 
+ * stays busy for up to 25 ms, check flash_busy() before the next operation.
+ *
+ * @param address any address inside the sector.
+ * @return
+ * @retval true if the erase was started.
+ * @retval false if operation is failed.
+ */
+bool flash_sector_erase_start(uint32_t address)
+{
+	spi_transfer_t t = {.command = {SECTOR_ERASE,(address & 0xFFFFFF) >> 16,(address & 0xFFFF)>> 8,address & 0xFF}, .command_length = 4};
+	flash_cache_drop(address & ~(uint32_t)0xFFF, 0x1000);
 	if(!flash_write_enable())
 	{
 		return false;
 	}
-	bool result = spi_master_tx(SPI_MODULE, 1, &tx_data);
-	nrf_delay_ms(100);
-	return result;
+	return flash_transfer(&t);
 }
 
 /**
@@ -425,12 +541,8 @@ bool flash_chip_erase(void)
  */
 bool flash_read_status(uint8_t *data)
 {
-	uint8_t tx_data[2] = {RDSR,0x00};
-	uint8_t rx_data[2];
-	
-	bool result = spi_master_tx_rx(SPI_MODULE, 2, tx_data, rx_data);
-	*data = rx_data[1];
-	return result; 
+	spi_transfer_t t = {.command = {RDSR}, .command_length = 1, .rx = data, .length = 1};
+	return flash_transfer(&t);
 }
 
 /**
@@ -442,8 +554,21 @@ bool flash_read_status(uint8_t *data)
  */
 bool flash_enable_WSR(void)
 {
-	uint8_t tx_data = EWSR;
-	return spi_master_tx(SPI_MODULE, 1, &tx_data);
+	spi_transfer_t t = {.command = {EWSR}, .command_length = 1};
+	return flash_transfer(&t);
+}
+
+/**
+ * Non-blocking check for a running program or erase operation.
+ *
+ * @return
+ * @retval true if the chip is busy or could not be read.
+ * @retval false if the chip is ready.
+ */
+bool flash_busy(void)
+{
+	uint8_t status;
+	return !flash_read_status(&status) || (status & STATUS_BUSY);
 }
 
 /**
@@ -455,8 +580,8 @@ bool flash_enable_WSR(void)
  */
 bool flash_set_WRSR(void)
 {
-	uint8_t tx_data[2] = {WRSR,0x00};	
-	return spi_master_tx(SPI_MODULE, 2, tx_data);
+	spi_transfer_t t = {.command = {WRSR,0x00}, .command_length = 2};
+	return flash_transfer(&t);
 }
 
 /**
@@ -474,15 +599,92 @@ bool flash_set_WRSR(void)
  */
 bool flash_write_byte(uint32_t address, uint8_t data)
 {
-	uint8_t tx_data[5] = {BYTEWRITE,(address & 0xFFFFFF) >> 16,(address & 0xFFFF)>> 8,address & 0xFF,data};
+	spi_transfer_t t = {.command = {BYTEWRITE,(address & 0xFFFFFF) >> 16,(address & 0xFFFF)>> 8,address & 0xFF,data}, .command_length = 5};
+	flash_cache_drop(address, 1);
 	if(!flash_write_enable())
 	{
 		return false;
 	}
-	bool result = spi_master_tx(SPI_MODULE, 5, tx_data);
-	nrf_delay_us(20);
-	return result;
+	if(!flash_transfer(&t))
+	{
+		return false;
+	}
+	return flash_wait_ready(FLASH_BYTE_TIMEOUT_US);
+}
+
+#ifdef FLASH_AAI_WORD
+/**
+ * Word-AAI programming for parts that support it (build with -DFLASH_AAI_WORD). Two bytes go out per 
+ * command, which halves the command overhead and the number of busy periods. Word-AAI needs an even 
+ * address, so an odd first or last byte is written with a byte-program.
+ */
+static bool flash_aai_word(uint8_t command, const uint8_t *tx, uint8_t length)
+{
+	spi_transfer_t t = {.command = {command}, .command_length = length + 1};
+
+	memcpy(&t.command[1], tx, length);
+	if(!flash_transfer(&t))
+	{
+		return false;
+	}
+	return flash_wait_ready(FLASH_BYTE_TIMEOUT_US);
+}
+
+static bool flash_write_words(uint32_t address, uint8_t *data, uint32_t count)
+{
+	uint8_t tx_data[5];
+	bool first = true;
+
+	flash_cache_drop(address, count);
+	if((address & 1) && count)
+	{
+		if(!flash_write_byte(address++, *data++))
+		{
+			return false;
+		}
+		count--;
+	}
+	if(count >= 2)
+	{
+		if(!flash_write_enable())
+		{
+			return false;
+		}
+		while(count >= 2)
+		{
+			if(first)
+			{
+				tx_data[0] = (address & 0xFFFFFF) >> 16;
+				tx_data[1] = (address & 0xFFFF) >> 8;
+				tx_data[2] = address & 0xFF;
+				tx_data[3] = data[0];
+				tx_data[4] = data[1];
+				first = false;
+				if(!flash_aai_word(AAI_WORD, tx_data, 5))
+				{
+					return false;
+				}
+			}
+			else if(!flash_aai_word(AAI_WORD, data, 2))
+			{
+				return false;
+			}
+			address += 2;
+			data += 2;
+			count -= 2;
+		}
+		if(!flash_write_disable())
+		{
+			return false;
+		}
+	}
+	if(count)
+	{
+		return flash_write_byte(address, *data);
+	}
+	return true;
 }
+#endif
 
 /**
  * Writes multi-byte data into memory starting from specified address. Each memory location (address) 
@@ -501,12 +703,64 @@ bool flash_write_byte(uint32_t address, uint8_t data)
  */
 bool flash_write_bytes(uint32_t address, uint8_t *data, uint32_t count)
 {
-	if(!flash_write_enable())
+#ifdef FLASH_AAI_WORD
+	return flash_write_words(address, data, count);
+#else
+	while (flash_job.active);
+	if(!flash_write_start(address, data, count, 0))
 	{
 		return false;
 	}
-	uint8_t tx_data[4] = {AAI,(address & 0xFFFFFF) >> 16,(address & 0xFFFF)>> 8,address & 0xFF};
-	return spi_master_tx_rx_fast_write(SPI_MODULE, count, tx_data, data);
+	while (flash_job.active);
+	return flash_job.ok;
+#endif
+}
+
+/**
+ * Starts writing multi-byte data like flash_write_bytes() and returns right away. The bytes are programmed 
+ * from the SPI interrupt, the synchronous flash_*() calls wait for the write to finish. 
+ *
+ * @note data must stay in place until the write is done. Word-AAI builds write synchronously and call 
+ *       done before returning.
+ *
+ * @param address starting address (between 0x000000 to 0x01FFFF) from which the data should be stored.
+ * @param data pointer to uint8_t type array containing data.
+ * @param count number of bytes to be stored.
+ * @param done called from the interrupt with the result once the chip is free again, may be 0.
+ * @return
+ * @retval true if the write was started.
+ * @retval false if another write is still running or the data does not fit.
+ */
+bool flash_write_start(uint32_t address, const uint8_t *data, uint32_t count, void (*done)(bool ok))
+{
+	if(flash_job.active || count < 1 || address + count > FLASH_SIZE)
+	{
+		return false;
+	}
+#ifdef FLASH_AAI_WORD
+	flash_job.ok = flash_write_words(address, (uint8_t *)data, count);
+	if(done)
+	{
+		done(flash_job.ok);
+	}
+	return true;
+#else
+	flash_cache_drop(address, count);
+	flash_job.data = data;
+	flash_job.address = address;
+	flash_job.left = count;
+	flash_job.phase = FLASH_JOB_WREN;
+	flash_job.ok = true;
+	flash_job.done = done;
+	flash_job.step = (spi_transfer_t){.command = {WREN}, .command_length = 1, .callback = flash_job_step};
+	flash_job.active = true;
+	if(!spi_queue(&flash_job.step))
+	{
+		flash_job.active = false;
+		return false;
+	}
+	return true;
+#endif
 }
 
 /**
@@ -522,11 +776,8 @@ bool flash_write_bytes(uint32_t address, uint8_t *data, uint32_t count)
  */
 bool flash_read_byte(uint32_t address, uint8_t *buffer)
 {
-	uint8_t tx_data[5] = {BYTEREAD,(address & 0xFFFFFF) >> 16,(address & 0xFFFF)>> 8,address & 0xFF,0x00};
-	uint8_t rx_data[5];
-	bool result = spi_master_tx_rx(SPI_MODULE, 5, tx_data, rx_data);
-    *buffer = rx_data[4];
-	return result;
+	spi_transfer_t t = {.command = {BYTEREAD,(address & 0xFFFFFF) >> 16,(address & 0xFFFF)>> 8,address & 0xFF}, .command_length = 4, .rx = buffer, .length = 1};
+	return flash_transfer(&t);
 }
 
 /**
@@ -543,8 +794,142 @@ bool flash_read_byte(uint32_t address, uint8_t *buffer)
  */
 bool flash_read_bytes(uint32_t address, uint8_t *buffer, uint32_t count)
 {
-	uint8_t tx_data[4] = {BYTEREAD,(address & 0xFFFFFF) >> 16,(address & 0xFFFF)>> 8,address & 0xFF};
-	return spi_master_tx_rx_fast_read(SPI_MODULE, count, tx_data, buffer);
+	spi_transfer_t t = {.command = {BYTEREAD,(address & 0xFFFFFF) >> 16,(address & 0xFFFF)>> 8,address & 0xFF}, .command_length = 4, .rx = buffer, .length = count};
+	if(count < 1)
+	{
+		return false;
+	}
+	return flash_transfer(&t);
+}
+
+/**
+ * Reads the 256 byte page holding the given address through the read cache.
+ *
+ * @param address any address inside the page.
+ * @return pointer to the start of the page, valid until the next flash_*() call, or 0 if the read failed 
+ *         or the chip is still busy with a program or erase operation.
+ */
+const uint8_t *flash_read_page(uint32_t address)
+{
+	uint32_t page = address & ~(uint32_t)(FLASH_PAGE_SIZE - 1);
+
+	if(page == flash_page_address)
+	{
+		return flash_page;
+	}
+	//a busy chip reads back garbage, which must not stay in the cache
+	flash_page_address = FLASH_NO_PAGE;
+	if(page >= FLASH_SIZE || flash_busy() || !flash_read_bytes(page, flash_page, FLASH_PAGE_SIZE))
+	{
+		return 0;
+	}
+	flash_page_address = page;
+	return flash_page;
+}
+
+/**
+ * Reads multi-byte data like flash_read_bytes(), but through the read cache. Meant for sequential 
+ * reads, each page is fetched once however many calls it takes to read it and reads run on across 
+ * page boundaries.
+ *
+ * @param address starting address (between 0x000000 to 0x01FFFF) from which the data is read.
+ * @param buffer pointer to uint8_t type array where data is stored.
+ * @param count number of bytes to be read.
+ * @return
+ * @retval true if operation is successful.
+ * @retval false if operation is failed or the data runs past the end of the chip.
+ */
+bool flash_read_cached(uint32_t address, uint8_t *buffer, uint32_t count)
+{
+	const uint8_t *page;
+	uint32_t n;
+
+	while(count > 0)
+	{
+		page = flash_read_page(address);
+		if(page == 0)
+		{
+			return false;
+		}
+		n = FLASH_PAGE_SIZE - address % FLASH_PAGE_SIZE;
+		if(n > count)
+		{
+			n = count;
+		}
+		memcpy(buffer, &page[address % FLASH_PAGE_SIZE], n);
+		address += n;
+		buffer += n;
+		count -= n;
+	}
+	return true;
+}
+
+#define FLASH_BENCH_ADDRESS     0x1F000 // last sector
+#define FLASH_BENCH_SIZE        4096
+#define FLASH_BENCH_CHUNK       32
+
+/**
+ * Erases the last sector, fills it in FLASH_BENCH_CHUNK byte writes, reads it back directly and
+ * through the read cache and prints the erase time and the achieved write and read throughput. Destroys whatever was in that sector.
+ */
+void flash_benchmark(void)
+{
+	uint8_t buf[FLASH_BENCH_CHUNK];
+	uint32_t address, start, erase_us, write_us, read_us, cached_us;
+	bool ok, verified = true;
+	int i;
+
+	//the log may still be erasing a sector in the background
+	ok = flash_wait_ready(FLASH_SECTOR_ERASE_TIMEOUT_US);
+
+	start = get_time_us();
+	ok = ok && flash_sector_erase(FLASH_BENCH_ADDRESS);
+	erase_us = get_time_us() - start;
+
+	for (i = 0; i < FLASH_BENCH_CHUNK; i++)
+	{
+		buf[i] = i;
+	}
+	start = get_time_us();
+	for (address = FLASH_BENCH_ADDRESS; ok && address < FLASH_BENCH_ADDRESS + FLASH_BENCH_SIZE; address += FLASH_BENCH_CHUNK)
+	{
+		ok = flash_write_bytes(address, buf, FLASH_BENCH_CHUNK);
+	}
+	write_us = get_time_us() - start + 1;
+
+	start = get_time_us();
+	for (address = FLASH_BENCH_ADDRESS; ok && address < FLASH_BENCH_ADDRESS + FLASH_BENCH_SIZE; address += FLASH_BENCH_CHUNK)
+	{
+		ok = flash_read_bytes(address, buf, FLASH_BENCH_CHUNK);
+		for (i = 0; i < FLASH_BENCH_CHUNK; i++)
+		{
+			if (buf[i] != i)
+			{
+				verified = false;
+			}
+		}
+	}
+	read_us = get_time_us() - start + 1;
+
+	start = get_time_us();
+	for (address = FLASH_BENCH_ADDRESS; ok && address < FLASH_BENCH_ADDRESS + FLASH_BENCH_SIZE; address += FLASH_BENCH_CHUNK)
+	{
+		ok = flash_read_cached(address, buf, FLASH_BENCH_CHUNK);
+		for (i = 0; i < FLASH_BENCH_CHUNK; i++)
+		{
+			if (buf[i] != i)
+			{
+				verified = false;
+			}
+		}
+	}
+	cached_us = get_time_us() - start + 1;
+
+	printf("FLASH: erase %lu us, write %lu B/s, read %lu B/s, cached %lu B/s, %s\n", erase_us,
+		(uint32_t)((uint64_t)FLASH_BENCH_SIZE * 1000000 / write_us),
+		(uint32_t)((uint64_t)FLASH_BENCH_SIZE * 1000000 / read_us),
+		(uint32_t)((uint64_t)FLASH_BENCH_SIZE * 1000000 / cached_us),
+		!ok ? "failed" : verified ? "verified" : "mismatch");
 }
 
 /**
@@ -586,10 +971,7 @@ bool spi_flash_init(void)
 	{
 		return false;
 	}
-	if(!flash_chip_erase())
-	{
-		return false;
-	}
+	//the flight log is kept across resets, logging.c erases ahead of itself
 	if(!flash_write_enable())
 	{
 		return false;
@@ -2,6 +2,11 @@
  *  timers.c -- TIMER2 is for time-keeping, TIMER1 for motors. 
  *		TIMER0 is for soft-device
  *
+ *  TIMER2 counts microseconds in 16 bit mode, the interrupt on CC[2]
+ *  counts the times it goes round. now_us64() puts the two together,
+ *  get_time_us() is the low 32 bits of it for cheap differences.
+ *  CC[1] is set by timer_wake_at() to wake the cpu from idle sleep.
+ *
  *  I. Protonotarios
  *  Embedded Software Lab
  *
@@ -10,20 +15,23 @@
  */
 
 #include "in4073.h"
+#include "isr_stats.h"
  
-static bool TIMER2_flag;
-static uint32_t global_time;
+static uint32_t timer_wraps;	// times TIMER2 went round, 65536 us each
+#ifdef ISR_STATS
+static uint16_t timer1_cleared;	// TIMER2 count as the motor pulses started
+#endif
 
 void timers_init(void)
 {
-	global_time = 0;
-	TIMER2_flag = false;
+	timer_wraps = 0;
 
+	NRF_TIMER2->BITMODE	= TIMER_BITMODE_BITMODE_16Bit;
 	NRF_TIMER2->PRESCALER 	= 0x4UL; // 1us 
 	NRF_TIMER2->INTENSET	= TIMER_INTENSET_COMPARE0_Msk | TIMER_INTENSET_COMPARE1_Msk | TIMER_INTENSET_COMPARE2_Msk;
 	NRF_TIMER2->CC[0]	= 2500; // 400 Hz.
-	NRF_TIMER2->CC[1]	= TIMER_PERIOD; // defined in in4073.h
-	NRF_TIMER2->CC[2]	= 0xffff; // "overflow interrupt" for keeping global time
+	NRF_TIMER2->CC[1]	= 0; // wake up, see timer_wake_at()
+	NRF_TIMER2->CC[2]	= 0; // "overflow interrupt", fires as the count goes round to 0
 	NRF_TIMER2->TASKS_CLEAR = 1;
 
 	NRF_TIMER1->PRESCALER 	= 0x4UL; // 1us
@@ -48,69 +56,119 @@ void timers_init(void)
 
 void TIMER2_IRQHandler(void)
 {
+	ISR_ENTER(ISR_TIMER2);
+
 	if (NRF_TIMER2->EVENTS_COMPARE[0])
     	{
+		ISR_LATENCY(ISR_TIMER2, NRF_TIMER2->CC[0]);
 		NRF_TIMER2->CC[0] += 2500;
 		NRF_TIMER1->TASKS_CLEAR = 1;
+#ifdef ISR_STATS
+		timer1_cleared = profile_now();
+#endif
 		nrf_gpio_pin_set(MOTOR_0_PIN); nrf_gpio_pin_set(MOTOR_1_PIN); nrf_gpio_pin_set(MOTOR_2_PIN); nrf_gpio_pin_set(MOTOR_3_PIN);
 		NRF_TIMER2->EVENTS_COMPARE[0] = 0;
     	}
 
 	if (NRF_TIMER2->EVENTS_COMPARE[1])
     	{
-		NRF_TIMER2->CC[1] += TIMER_PERIOD;
-		TIMER2_flag = true;
+		//the interrupt itself is the wake up
+		ISR_LATENCY(ISR_TIMER2, NRF_TIMER2->CC[1]);
 		NRF_TIMER2->EVENTS_COMPARE[1] = 0;
     	}
 
 	if (NRF_TIMER2->EVENTS_COMPARE[2])
     	{
-		global_time += 0xffff;
+		ISR_LATENCY(ISR_TIMER2, NRF_TIMER2->CC[2]);
+		timer_wraps++;
 		NRF_TIMER2->EVENTS_COMPARE[2] = 0;
     	}
 
+	ISR_EXIT(ISR_TIMER2);
 }
 
 void TIMER1_IRQHandler(void)
 {
+	ISR_ENTER(ISR_TIMER1);
+
 	if (NRF_TIMER1->EVENTS_COMPARE[0])
     	{
+		ISR_LATENCY(ISR_TIMER1, timer1_cleared + NRF_TIMER1->CC[0]);
 		nrf_gpio_pin_clear(MOTOR_0_PIN);
 		NRF_TIMER1->EVENTS_COMPARE[0] = 0;
     	}
 
 	if (NRF_TIMER1->EVENTS_COMPARE[1])
     	{
+		ISR_LATENCY(ISR_TIMER1, timer1_cleared + NRF_TIMER1->CC[1]);
 		nrf_gpio_pin_clear(MOTOR_1_PIN);
 		NRF_TIMER1->EVENTS_COMPARE[1] = 0;
     	}
 
 	if (NRF_TIMER1->EVENTS_COMPARE[2])
     	{
+		ISR_LATENCY(ISR_TIMER1, timer1_cleared + NRF_TIMER1->CC[2]);
 		nrf_gpio_pin_clear(MOTOR_2_PIN);
 		NRF_TIMER1->EVENTS_COMPARE[2] = 0;
     	}
 
 	if (NRF_TIMER1->EVENTS_COMPARE[3])
     	{
+		ISR_LATENCY(ISR_TIMER1, timer1_cleared + NRF_TIMER1->CC[3]);
 		nrf_gpio_pin_clear(MOTOR_3_PIN);
 		NRF_TIMER1->EVENTS_COMPARE[3] = 0;
     	}
+
+	ISR_EXIT(ISR_TIMER1);
 }
 
 
-uint32_t get_time_us(void)
+/*------------------------------------------------------------------
+ * reads the count and the number of wraps as one. the count may have
+ * gone round with the interrupt still to come, the event is still
+ * set then and the count is small.
+ *------------------------------------------------------------------
+ */
+static uint32_t read_timer(uint32_t *wraps)
 {
-	NRF_TIMER2->TASKS_CAPTURE[3]=1;
-	return global_time+NRF_TIMER2->CC[3];
+	uint32_t primask = __get_PRIMASK();
+	uint32_t count;
+
+	//not only TIMER2, any handler may capture into CC[3]
+	__disable_irq();
+	NRF_TIMER2->TASKS_CAPTURE[3] = 1;
+	count = NRF_TIMER2->CC[3] & 0xffff;
+	*wraps = timer_wraps;
+	if (NRF_TIMER2->EVENTS_COMPARE[2] && count < 0x8000)
+	{
+		(*wraps)++;
+	}
+	__set_PRIMASK(primask);
+	return count;
 }
 
-bool check_timer_flag(void)
+/* microseconds since timers_init(), does not wrap */
+uint64_t now_us64(void)
 {
-	return TIMER2_flag;
+	uint32_t wraps, count;
+
+	count = read_timer(&wraps);
+	return (uint64_t)wraps << 16 | count;
+}
+
+/* the low 32 bits of now_us64(), wraps after 71 minutes. differences
+ * of two readings are right across the wrap */
+uint32_t get_time_us(void)
+{
+	uint32_t wraps, count;
+
+	count = read_timer(&wraps);
+	return wraps << 16 | count;
 }
 
-void clear_timer_flag(void)
+/* has the TIMER2 interrupt come when the low 16 bits of get_time_us()
+ * next reach those of time_us, at most 65 ms on */
+void timer_wake_at(uint32_t time_us)
 {
-	TIMER2_flag = false;
+	NRF_TIMER2->CC[1] = time_us & 0xffff;
 }
@@ -11,6 +11,7 @@
  */
 
 #include "in4073.h"
+#include "isr_stats.h"
 
 static volatile bool sent = false;
 static volatile bool read = false;
@@ -72,9 +73,28 @@ bool i2c_write(uint8_t slave_addr, uint8_t reg_addr, uint8_t data_length, uint8_
 
 	return 0;
 }
+
+//a lone command byte, waits until it is out so the bus is free for the next transfer
+bool i2c_command(uint8_t slave_addr, uint8_t command)
+{
+	sent = false;
+	NRF_TWI0->ADDRESS = slave_addr;
+	NRF_TWI0->SHORTS = 0;
+	NRF_TWI0->TXD = command;
+	NRF_TWI0->TASKS_STARTTX = 1;
+
+	while(!sent);
+	sent = false;
+
+	NRF_TWI0->TASKS_STOP = 1;
+
+	return 0;
+}
 	
 void SPI0_TWI0_IRQHandler(void) 
 {
+	ISR_ENTER(ISR_TWI0);
+
 	if(NRF_TWI0->EVENTS_RXDREADY != 0)
 	{
 		NRF_TWI0->EVENTS_RXDREADY = 0;
@@ -114,6 +134,7 @@ void SPI0_TWI0_IRQHandler(void)
         	NRF_TWI0->EVENTS_BB = 0;
     	}	
 */
+	ISR_EXIT(ISR_TWI0);
 }
 
 
@@ -10,7 +10,25 @@
 
 #include "in4073.h"
 #include "states.h"
-
+#include "protocol/protocol.h"
+#include "isr_stats.h"
+
+#if LINK_BAUDRATE == 115200
+#define UART_BAUDRATE	UART_BAUDRATE_BAUDRATE_Baud115200
+#elif LINK_BAUDRATE == 230400
+#define UART_BAUDRATE	UART_BAUDRATE_BAUDRATE_Baud230400
+#elif LINK_BAUDRATE == 460800
+#define UART_BAUDRATE	UART_BAUDRATE_BAUDRATE_Baud460800
+#elif LINK_BAUDRATE == 921600
+#define UART_BAUDRATE	UART_BAUDRATE_BAUDRATE_Baud921600
+#elif LINK_BAUDRATE == 1000000
+#define UART_BAUDRATE	UART_BAUDRATE_BAUDRATE_Baud1M
+#else
+#error "LINK_BAUDRATE not supported by the nRF51 UART"
+#endif
+
+queue rx_queue;
+queue tx_queue;
 bool txd_available = true;
 
 void uart_put(uint8_t byte)
@@ -40,6 +58,8 @@ int _write(int file, const char * p_char, int len)
 
 void UART0_IRQHandler(void)
 {
+	ISR_ENTER(ISR_UART);
+
 	if (NRF_UART0->EVENTS_RXDRDY != 0)
     	{
 		NRF_UART0->EVENTS_RXDRDY  = 0;
@@ -62,6 +82,8 @@ void UART0_IRQHandler(void)
         	NRF_UART0->EVENTS_ERROR = 0;
         	printf("uart error: %lu\n", NRF_UART0->ERRORSRC);
     	}
+
+	ISR_EXIT(ISR_UART);
 }
 
 void uart_init(void)
@@ -73,7 +95,7 @@ void uart_init(void)
 	nrf_gpio_cfg_input(RX_PIN_NUMBER, NRF_GPIO_PIN_NOPULL); 
 	NRF_UART0->PSELTXD = TX_PIN_NUMBER;
 	NRF_UART0->PSELRXD = RX_PIN_NUMBER;
-	NRF_UART0->BAUDRATE        = (UART_BAUDRATE_BAUDRATE_Baud115200 << UART_BAUDRATE_BAUDRATE_Pos);
+	NRF_UART0->BAUDRATE        = (UART_BAUDRATE << UART_BAUDRATE_BAUDRATE_Pos);
 
 	NRF_UART0->ENABLE           = (UART_ENABLE_ENABLE_Enabled << UART_ENABLE_ENABLE_Pos);
 	NRF_UART0->EVENTS_RXDRDY    = 0;
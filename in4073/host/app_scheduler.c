@@ -0,0 +1,72 @@
+/*------------------------------------------------------------------
+ *  app_scheduler.c -- the event queue of app_scheduler.h for the host
+ *
+ *  the SDK one packs a handler pointer into a 4 byte header, which
+ *  does not hold one on a 64 bit host. same calls, own storage.
+ *
+ *  jmi
+ *------------------------------------------------------------------
+ */
+
+#include <string.h>
+#include "app_scheduler.h"
+
+#define HOST_SCHED_QUEUE	8
+#define HOST_SCHED_EVENT_MAX	16
+
+typedef struct {
+	app_sched_event_handler_t handler;
+	uint16_t size;
+	uint8_t data[HOST_SCHED_EVENT_MAX];
+} host_sched_event_t;
+
+static host_sched_event_t sched_queue[HOST_SCHED_QUEUE];
+static uint16_t sched_event_size;
+static uint16_t sched_queue_size;
+static uint16_t sched_first, sched_count;
+
+uint32_t app_sched_init(uint16_t max_event_size, uint16_t queue_size, void *p_evt_buffer)
+{
+	if (max_event_size > HOST_SCHED_EVENT_MAX || queue_size > HOST_SCHED_QUEUE)
+	{
+		return NRF_ERROR_INVALID_LENGTH;
+	}
+	sched_event_size = max_event_size;
+	sched_queue_size = queue_size;
+	sched_first = 0;
+	sched_count = 0;
+	return NRF_SUCCESS;
+}
+
+uint32_t app_sched_event_put(void *p_event_data, uint16_t event_size, app_sched_event_handler_t handler)
+{
+	host_sched_event_t *e;
+
+	if (event_size > sched_event_size)
+	{
+		return NRF_ERROR_INVALID_LENGTH;
+	}
+	if (sched_count == sched_queue_size)
+	{
+		return NRF_ERROR_NO_MEM;
+	}
+	e = &sched_queue[(sched_first + sched_count) % sched_queue_size];
+	e->handler = handler;
+	e->size = event_size;
+	memcpy(e->data, p_event_data, event_size);
+	sched_count++;
+	return NRF_SUCCESS;
+}
+
+void app_sched_execute(void)
+{
+	host_sched_event_t e;
+
+	while (sched_count)
+	{
+		e = sched_queue[sched_first];
+		sched_first = (sched_first + 1) % sched_queue_size;
+		sched_count--;
+		e.handler(e.data, e.size);
+	}
+}
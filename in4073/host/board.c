@@ -0,0 +1,133 @@
+/*------------------------------------------------------------------
+ *  board.c -- the rest of the drone for the host build, see hal.h
+ *
+ *  the leds and the motor pulses are where the firmware writes them,
+ *  the adc gives the battery voltage set last at the next service.
+ *  the watchdog counts from its last feed, past the reload value it
+ *  runs the handler and resets. a reset ends the process, with exit
+ *  code 2 after the watchdog and 0 otherwise.
+ *
+ *  jmi
+ *------------------------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include "in4073.h"
+#include "app_scheduler.h"
+#include "nrf_drv_wdt.h"
+#include "isr_stats.h"
+#include "hal.h"
+
+#define HOST_BATTERY	1150	// a charged 3 cell pack
+
+NRF_TIMER_Type host_timer1 = {.CC = {1000, 1000, 1000, 1000}};
+NRF_POWER_Type host_power;
+uint32_t host_gpio_out;
+uint16_t bat_volt;
+
+static uint16_t battery = HOST_BATTERY;
+static bool adc_pending;
+
+static nrf_wdt_event_handler_t wdt_handler;
+static uint64_t wdt_reload_us;
+static uint64_t wdt_fed_us;
+static bool wdt_running;
+
+void gpio_init(void)
+{
+	nrf_gpio_pin_set(RED);
+	nrf_gpio_pin_set(YELLOW);
+	nrf_gpio_pin_set(GREEN);
+	nrf_gpio_pin_set(BLUE);
+}
+
+bool host_led(uint32_t pin)
+{
+	return !nrf_gpio_pin_read(pin);
+}
+
+uint16_t host_motor(int i)
+{
+	return host_timer1.CC[i];
+}
+
+void host_battery_set(uint16_t volt)
+{
+	battery = volt;
+}
+
+void adc_init(void)
+{
+}
+
+void adc_request_sample(void)
+{
+	adc_pending = true;
+}
+
+ret_code_t nrf_drv_wdt_init(nrf_drv_wdt_config_t const *p_config, nrf_wdt_event_handler_t wdt_event_handler)
+{
+	wdt_handler = wdt_event_handler;
+	wdt_reload_us = (uint64_t)p_config->reload_value * 1000;
+	return NRF_SUCCESS;
+}
+
+ret_code_t nrf_drv_wdt_channel_alloc(nrf_drv_wdt_channel_id *p_channel_id)
+{
+	*p_channel_id = 0;
+	return NRF_SUCCESS;
+}
+
+void nrf_drv_wdt_enable(void)
+{
+	wdt_fed_us = host_time_us();
+	wdt_running = true;
+}
+
+void nrf_drv_wdt_channel_feed(nrf_drv_wdt_channel_id channel_id)
+{
+	wdt_fed_us = host_time_us();
+}
+
+uint64_t host_board_next_us(void)
+{
+	if (adc_pending)
+	{
+		return 0;
+	}
+	return wdt_running ? wdt_fed_us + wdt_reload_us + 1 : UINT64_MAX;
+}
+
+void host_board_service(void)
+{
+	if (adc_pending)
+	{
+		adc_pending = false;
+		bat_volt = battery;
+		app_sched_event_put((void *)&bat_volt, sizeof(bat_volt), battery_sampled);
+	}
+	if (wdt_running && host_time_us() - wdt_fed_us > wdt_reload_us)
+	{
+		wdt_handler();
+		host_reset(POWER_RESETREAS_DOG_Msk);
+	}
+}
+
+void host_reset(uint32_t reason)
+{
+	fflush(stdout);
+	fprintf(stderr, "host: %s reset\n", reason & POWER_RESETREAS_DOG_Msk ? "watchdog" : "software");
+	exit(reason & POWER_RESETREAS_DOG_Msk ? 2 : 0);
+}
+
+void app_error_handler(uint32_t error_code, uint32_t line_num, const uint8_t *p_file_name)
+{
+	fprintf(stderr, "host: error %lu at %s:%lu\n", (unsigned long)error_code,
+		p_file_name ? (const char *)p_file_name : "?", (unsigned long)line_num);
+	exit(1);
+}
+
+void isr_report(void)
+{
+	printf("ISR: no interrupts on the host\n");
+}
@@ -0,0 +1,255 @@
+/*------------------------------------------------------------------
+ *  flash.c -- the SST25VF010A of the host build, see hal.h
+ *
+ *  the chip is an array in RAM with the rules of the real one: an
+ *  erase sets bytes to 0xFF, programming can only clear bits. the
+ *  contents change at once, but the chip stays busy for the worst
+ *  case times of drivers/spi_flash.c, the synchronous calls wait
+ *  that out and a background write calls back once it is over.
+ *  with host_flash_image() the log outlives the process.
+ *
+ *  jmi
+ *------------------------------------------------------------------
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include "in4073.h"
+#include "hal.h"
+
+#define FLASH_SIZE		0x20000
+#define FLASH_SECTOR_SIZE	0x1000
+#define FLASH_PAGE_SIZE		256
+
+#define FLASH_BYTE_US		20
+#define FLASH_SECTOR_ERASE_US	25000
+#define FLASH_CHIP_ERASE_US	100000
+
+static uint8_t flash[FLASH_SIZE];
+static bool flash_loaded;
+static int flash_fd = -1;
+static uint64_t flash_busy_until;
+static uint64_t flash_write_done_us = UINT64_MAX;
+static void (*flash_write_done)(bool ok);
+
+bool host_flash_image(const char *path)
+{
+	ssize_t n;
+
+	flash_fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (flash_fd < 0)
+	{
+		return false;
+	}
+	memset(flash, 0xFF, sizeof(flash));
+	n = pread(flash_fd, flash, sizeof(flash), 0);
+	if (n < (ssize_t)sizeof(flash) && pwrite(flash_fd, flash, sizeof(flash), 0) != sizeof(flash))
+	{
+		return false;
+	}
+	flash_loaded = true;
+	return true;
+}
+
+uint8_t *host_flash_memory(void)
+{
+	return flash;
+}
+
+static void flash_changed(uint32_t address, uint32_t count, uint32_t busy_us)
+{
+	if (flash_fd >= 0 && pwrite(flash_fd, &flash[address], count, address) != (ssize_t)count)
+	{
+		fprintf(stderr, "host: cannot write the flash image\n");
+	}
+	flash_busy_until = host_time_us() + busy_us;
+}
+
+static void flash_program(uint32_t address, const uint8_t *data, uint32_t count)
+{
+	uint32_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		flash[address + i] &= data[i];
+	}
+	flash_changed(address, count, count * FLASH_BYTE_US);
+}
+
+bool flash_write_pending(void)
+{
+	return flash_write_done_us != UINT64_MAX;
+}
+
+uint64_t host_flash_next_us(void)
+{
+	return flash_write_done_us;
+}
+
+void host_flash_service(void)
+{
+	void (*done)(bool ok) = flash_write_done;
+
+	if (host_time_us() < flash_write_done_us)
+	{
+		return;
+	}
+	flash_write_done_us = UINT64_MAX;
+	flash_write_done = 0;
+	if (done)
+	{
+		done(true);
+	}
+}
+
+bool flash_busy(void)
+{
+	return host_time_us() < flash_busy_until;
+}
+
+bool flash_wait_ready(uint32_t timeout_us)
+{
+	uint64_t now = host_time_us();
+
+	if (flash_busy())
+	{
+		nrf_delay_us(flash_busy_until - now < timeout_us ? flash_busy_until - now : timeout_us);
+	}
+	return !flash_busy();
+}
+
+static void flash_write_wait(void)
+{
+	uint64_t now;
+
+	while (flash_write_pending())
+	{
+		now = host_time_us();
+		if (now < flash_write_done_us)
+		{
+			nrf_delay_us(flash_write_done_us - now);
+		}
+		else
+		{
+			host_service();
+		}
+	}
+}
+
+/* the synchronous calls start once the chip is free and wait until it is again */
+static bool flash_ready(void)
+{
+	flash_write_wait();
+	return flash_wait_ready(FLASH_CHIP_ERASE_US);
+}
+
+bool spi_flash_init(void)
+{
+	if (!flash_loaded)
+	{
+		memset(flash, 0xFF, sizeof(flash));
+		flash_loaded = true;
+	}
+	return true;
+}
+
+bool flash_chip_erase(void)
+{
+	if (!flash_ready())
+	{
+		return false;
+	}
+	memset(flash, 0xFF, FLASH_SIZE);
+	flash_changed(0, FLASH_SIZE, FLASH_CHIP_ERASE_US);
+	return flash_ready();
+}
+
+bool flash_sector_erase_start(uint32_t address)
+{
+	address &= ~(uint32_t)(FLASH_SECTOR_SIZE - 1);
+	if (address >= FLASH_SIZE || flash_busy() || flash_write_pending())
+	{
+		return false;
+	}
+	memset(&flash[address], 0xFF, FLASH_SECTOR_SIZE);
+	flash_changed(address, FLASH_SECTOR_SIZE, FLASH_SECTOR_ERASE_US);
+	return true;
+}
+
+bool flash_sector_erase(uint32_t address)
+{
+	return flash_ready() && flash_sector_erase_start(address) && flash_ready();
+}
+
+bool flash_write_bytes(uint32_t address, uint8_t *data, uint32_t count)
+{
+	if (address + count > FLASH_SIZE || !flash_ready())
+	{
+		return false;
+	}
+	flash_program(address, data, count);
+	return flash_ready();
+}
+
+bool flash_write_byte(uint32_t address, uint8_t data)
+{
+	return flash_write_bytes(address, &data, 1);
+}
+
+bool flash_write_start(uint32_t address, const uint8_t *data, uint32_t count, void (*done)(bool ok))
+{
+	if (address + count > FLASH_SIZE || flash_write_pending() || flash_busy())
+	{
+		return false;
+	}
+	flash_program(address, data, count);
+	flash_write_done_us = flash_busy_until;
+	flash_write_done = done;
+	return true;
+}
+
+bool flash_read_bytes(uint32_t address, uint8_t *buffer, uint32_t count)
+{
+	uint32_t i;
+
+	//an erase still running reads back garbage on the drone, not here
+	flash_write_wait();
+	//runs on from the start of the chip past the end, as the chip does
+	for (i = 0; i < count; i++)
+	{
+		buffer[i] = flash[(address + i) % FLASH_SIZE];
+	}
+	return true;
+}
+
+bool flash_read_byte(uint32_t address, uint8_t *buffer)
+{
+	return flash_read_bytes(address, buffer, 1);
+}
+
+const uint8_t *flash_read_page(uint32_t address)
+{
+	uint32_t page = address & ~(uint32_t)(FLASH_PAGE_SIZE - 1);
+
+	if (page >= FLASH_SIZE || flash_busy() || flash_write_pending())
+	{
+		return 0;
+	}
+	return &flash[page];
+}
+
+bool flash_read_cached(uint32_t address, uint8_t *buffer, uint32_t count)
+{
+	if (address + count > FLASH_SIZE || flash_busy() || flash_write_pending())
+	{
+		return false;
+	}
+	memcpy(buffer, &flash[address], count);
+	return true;
+}
+
+void flash_benchmark(void)
+{
+	printf("FLASH: no benchmark on the host, the chip is in RAM\n");
+}
@@ -0,0 +1,92 @@
+#ifndef HAL_H__
+#define HAL_H__
+
+/*------------------------------------------------------------------
+ * hal.h -- the peripherals of the host build
+ *
+ * `make host` compiles the flight logic (in4073.c, control.c,
+ * logging.c, the scheduler, the watchdog supervisor, the queue and
+ * the barometer driver) as is with the headers in host/include in
+ * front of the SDK ones, and links it with the files in host/ in
+ * place of the drivers. they keep the prototypes of in4073.h:
+ *
+ * timers.c	the microsecond clock, real or virtual, and the waits
+ * uart.c	the link on stdin/stdout, a tty or a pseudo terminal
+ * twi.c	an i2c bus with the devices attached to it
+ * ms5611.c	the barometer on that bus
+ * imu.c	the mpu wrapper, samples set by the harness
+ * flash.c	the SST25VF010A in RAM, optionally kept in a file
+ * board.c	leds, motors, battery, watchdog and resets
+ *
+ * there are no interrupts. whenever the firmware waits, in the
+ * scheduler's sleep or in nrf_delay_ms(), or reads the clock with an
+ * event due, host_service() does what the interrupt handlers would
+ * have done by then, a loop that never waits still gets them. the
+ * firmware's main() is firmware_main(), host/main.c is the program
+ * around it. _build_host/libin4073.a has all but host/main.c, for
+ * tests, benchmarks and harnesses with a main of their own, such as
+ * host/sim.c, a quadrotor for the firmware to fly.
+ *
+ * jmi
+ *------------------------------------------------------------------
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+int firmware_main(void);
+
+// Clock
+void host_clock_virtual(void);		// time only moves while the firmware waits
+uint64_t host_time_us(void);
+void host_service(void);
+extern void (*host_tick)(uint64_t now_us);	// from host_service(), before the peripherals
+
+// UART
+bool host_uart_open(const char *path);	// a tty or fifo instead of stdin/stdout
+const char *host_uart_pty(void);	// a new pseudo terminal, its name for pc_terminal
+void host_uart_receive(const uint8_t *data, int length);	// as if it came over the link
+
+// I2C
+typedef struct {
+	uint8_t address;
+	bool (*write)(uint8_t reg, uint8_t length, const uint8_t *data);	// false for a nack
+	bool (*read)(uint8_t reg, uint8_t length, uint8_t *data);
+	bool (*command)(uint8_t command);
+} host_i2c_device_t;
+bool host_i2c_attach(const host_i2c_device_t *device);
+
+// Barometer, pressure in Pa and temperature in 0.01 C as read_baro() has them
+void host_ms5611_set(int32_t pressure, int32_t temperature);
+
+// IMU, in the units of the dmp: angles 10430/rad, gyro 16.4/deg/s, accel 16384/g
+typedef struct {
+	int16_t phi, theta, psi;
+	int16_t sp, sq, sr;
+	int16_t sax, say, saz;
+} host_imu_sample_t;
+void host_imu_set(const host_imu_sample_t *sample);
+void host_imu_period(uint32_t period_us);	// 0 for no sensor interrupts but those of host_imu_interrupt()
+void host_imu_interrupt(void);
+
+// Flash
+bool host_flash_image(const char *path);	// load it and write every change through
+uint8_t *host_flash_memory(void);
+
+// Board
+uint16_t host_motor(int i);			// pulse of motor i in us, 1000 is off
+bool host_led(uint32_t pin);			// on, the leds are active low
+void host_battery_set(uint16_t volt);		// as in bat_volt, 1050 is the threshold
+
+// between the host modules, for host_service() and the idle wait
+int host_uart_fd(void);
+void host_ms5611_attach(void);
+void host_uart_service(void);
+void host_imu_service(void);
+uint64_t host_imu_next_us(void);
+void host_flash_service(void);
+uint64_t host_flash_next_us(void);
+void host_board_service(void);
+uint64_t host_board_next_us(void);
+
+#endif // HAL_H__
@@ -0,0 +1,99 @@
+/*------------------------------------------------------------------
+ *  imu.c -- the mpu wrapper of the host build, see hal.h
+ *
+ *  the sensor interrupt comes every sample period, as the dmp gives
+ *  it, and the reads return the sample the harness set last. level
+ *  and at rest until it sets one.
+ *
+ *  jmi
+ *------------------------------------------------------------------
+ */
+
+#include <stdint.h>
+#include "in4073.h"
+#include "hal.h"
+
+#define IMU_DMP_PERIOD_US	10000	// the dmp runs at 100Hz
+#define IMU_ONE_G		16384
+
+int16_t phi, theta, psi;
+int16_t sp, sq, sr;
+int16_t sax, say, saz;
+uint8_t sensor_fifo_count;
+
+static host_imu_sample_t imu_sample = {.saz = IMU_ONE_G};
+static uint32_t imu_period_us;
+static uint64_t imu_next_us = UINT64_MAX;
+static volatile bool sensor_int_flag;
+
+void host_imu_set(const host_imu_sample_t *sample)
+{
+	imu_sample = *sample;
+}
+
+void host_imu_period(uint32_t period_us)
+{
+	imu_period_us = period_us;
+	imu_next_us = period_us ? host_time_us() + period_us : UINT64_MAX;
+}
+
+void host_imu_interrupt(void)
+{
+	sensor_int_flag = true;
+}
+
+uint64_t host_imu_next_us(void)
+{
+	return imu_next_us;
+}
+
+void host_imu_service(void)
+{
+	uint64_t now = host_time_us();
+
+	if (now < imu_next_us)
+	{
+		return;
+	}
+	sensor_int_flag = true;
+	imu_next_us += imu_period_us;
+	if (imu_next_us <= now)
+	{
+		//samples the firmware was too slow for are gone, as in the fifo
+		imu_next_us = now + imu_period_us;
+	}
+}
+
+void imu_init(bool dmp, uint16_t freq)
+{
+	host_imu_period(dmp ? IMU_DMP_PERIOD_US : 1000000 / freq);
+}
+
+void get_dmp_data(void)
+{
+	phi = imu_sample.phi;
+	theta = imu_sample.theta;
+	psi = imu_sample.psi;
+	get_raw_sensor_data();
+}
+
+void get_raw_sensor_data(void)
+{
+	sax = imu_sample.sax;
+	say = imu_sample.say;
+	saz = imu_sample.saz;
+	sp = imu_sample.sp;
+	sq = imu_sample.sq;
+	sr = imu_sample.sr;
+	sensor_fifo_count = 0;
+}
+
+bool check_sensor_int_flag(void)
+{
+	return sensor_int_flag;
+}
+
+void clear_sensor_int_flag(void)
+{
+	sensor_int_flag = false;
+}
@@ -0,0 +1,19 @@
+#ifndef APP_UTIL_PLATFORM_H__
+#define APP_UTIL_PLATFORM_H__
+
+/*------------------------------------------------------------------
+ * app_util_platform.h -- nothing preempts the host build, critical
+ * regions are empty
+ *------------------------------------------------------------------
+ */
+
+#include <stdint.h>
+#include "nrf.h"
+
+#define APP_IRQ_PRIORITY_HIGH	1
+#define APP_IRQ_PRIORITY_LOW	3
+
+#define CRITICAL_REGION_ENTER()	do {
+#define CRITICAL_REGION_EXIT()	} while (0)
+
+#endif // APP_UTIL_PLATFORM_H__
@@ -0,0 +1,47 @@
+#ifndef NRF_H__
+#define NRF_H__
+
+/*------------------------------------------------------------------
+ * nrf.h -- stands in for the device header in the host build, with
+ * only the registers the flight logic touches. TIMER1 holds the
+ * motor pulses as on the drone, POWER the reset reason. there are
+ * no interrupts to mask, the peripherals are serviced only while
+ * the firmware waits, see host/hal.h
+ *------------------------------------------------------------------
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+	volatile uint32_t CC[4];
+} NRF_TIMER_Type;
+
+typedef struct {
+	volatile uint32_t RESETREAS;
+	volatile uint32_t GPREGRET;
+} NRF_POWER_Type;
+
+extern NRF_TIMER_Type host_timer1;
+extern NRF_POWER_Type host_power;
+
+#define NRF_TIMER1	(&host_timer1)
+#define NRF_POWER	(&host_power)
+
+#define POWER_RESETREAS_RESETPIN_Msk	(0x1UL << 0)
+#define POWER_RESETREAS_DOG_Msk		(0x1UL << 1)
+#define POWER_RESETREAS_SREQ_Msk	(0x1UL << 2)
+#define POWER_RESETREAS_LOCKUP_Msk	(0x1UL << 3)
+#define POWER_RESETREAS_OFF_Msk		(0x1UL << 16)
+
+void host_reset(uint32_t reason) __attribute__((noreturn));
+void host_idle(void);
+
+#define NVIC_SystemReset()	host_reset(POWER_RESETREAS_SREQ_Msk)
+#define __WFE()			host_idle()
+#define __get_PRIMASK()		0
+#define __set_PRIMASK(x)	((void)(x))
+#define __disable_irq()		do {} while (0)
+#define __enable_irq()		do {} while (0)
+
+#endif // NRF_H__
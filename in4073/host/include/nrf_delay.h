@@ -0,0 +1,15 @@
+#ifndef NRF_DELAY_H__
+#define NRF_DELAY_H__
+
+/*------------------------------------------------------------------
+ * nrf_delay.h -- the delays of the host build service the peripherals
+ * while they wait, as the interrupts would, see host/timers.c
+ *------------------------------------------------------------------
+ */
+
+#include <stdint.h>
+
+void nrf_delay_us(uint32_t us);
+void nrf_delay_ms(uint32_t ms);
+
+#endif // NRF_DELAY_H__
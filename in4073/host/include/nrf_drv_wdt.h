@@ -0,0 +1,31 @@
+#ifndef NRF_DRV_WDT_H__
+#define NRF_DRV_WDT_H__
+
+/*------------------------------------------------------------------
+ * nrf_drv_wdt.h -- the watchdog driver of the host build counts on
+ * the host clock and resets the process once a channel goes
+ * unfed for WDT_CONFIG_RELOAD_VALUE ms, see host/board.c
+ *------------------------------------------------------------------
+ */
+
+#include <stdint.h>
+#include "nrf_error.h"
+
+#define WDT_CONFIG_RELOAD_VALUE	1000
+
+typedef uint32_t ret_code_t;
+typedef uint8_t nrf_drv_wdt_channel_id;
+typedef void (*nrf_wdt_event_handler_t)(void);
+
+typedef struct {
+	uint32_t reload_value;	// ms
+} nrf_drv_wdt_config_t;
+
+#define NRF_DRV_WDT_DEAFULT_CONFIG	{ .reload_value = WDT_CONFIG_RELOAD_VALUE }
+
+ret_code_t nrf_drv_wdt_init(nrf_drv_wdt_config_t const *p_config, nrf_wdt_event_handler_t wdt_event_handler);
+ret_code_t nrf_drv_wdt_channel_alloc(nrf_drv_wdt_channel_id *p_channel_id);
+void nrf_drv_wdt_enable(void);
+void nrf_drv_wdt_channel_feed(nrf_drv_wdt_channel_id channel_id);
+
+#endif // NRF_DRV_WDT_H__
@@ -0,0 +1,42 @@
+#ifndef NRF_GPIO_H__
+#define NRF_GPIO_H__
+
+/*------------------------------------------------------------------
+ * nrf_gpio.h -- the pins of the host build are bits in host_gpio_out
+ *------------------------------------------------------------------
+ */
+
+#include "nrf.h"
+
+typedef enum {
+	NRF_GPIO_PIN_NOPULL,
+	NRF_GPIO_PIN_PULLDOWN,
+	NRF_GPIO_PIN_PULLUP = 3,
+} nrf_gpio_pin_pull_t;
+
+extern uint32_t host_gpio_out;
+
+static inline void nrf_gpio_cfg_output(uint32_t pin) { (void)pin; }
+static inline void nrf_gpio_cfg_input(uint32_t pin, nrf_gpio_pin_pull_t pull) { (void)pin; (void)pull; }
+static inline void nrf_gpio_pin_set(uint32_t pin) { host_gpio_out |= 1UL << pin; }
+static inline void nrf_gpio_pin_clear(uint32_t pin) { host_gpio_out &= ~(1UL << pin); }
+static inline void nrf_gpio_pin_toggle(uint32_t pin) { host_gpio_out ^= 1UL << pin; }
+
+static inline void nrf_gpio_pin_write(uint32_t pin, uint32_t value)
+{
+	if (value)
+	{
+		nrf_gpio_pin_set(pin);
+	}
+	else
+	{
+		nrf_gpio_pin_clear(pin);
+	}
+}
+
+static inline uint32_t nrf_gpio_pin_read(uint32_t pin)
+{
+	return (host_gpio_out >> pin) & 1;
+}
+
+#endif // NRF_GPIO_H__
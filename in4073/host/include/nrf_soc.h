@@ -0,0 +1,15 @@
+#ifndef NRF_SOC_H__
+#define NRF_SOC_H__
+
+/*------------------------------------------------------------------
+ * nrf_soc.h -- the one softdevice call of the flight logic. on the
+ * host it waits for the next peripheral event or the TIMER2 wake up
+ *------------------------------------------------------------------
+ */
+
+#include <stdint.h>
+#include "nrf_error.h"
+
+uint32_t sd_app_evt_wait(void);
+
+#endif // NRF_SOC_H__
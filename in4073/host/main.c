@@ -0,0 +1,64 @@
+/*------------------------------------------------------------------
+ *  main.c -- runs the firmware on the pc, see hal.h
+ *
+ *  in4073 [-v] [-p | -u device] [-f image]
+ *	-v	virtual clock, as fast as the cpu goes
+ *	-p	link on a new pseudo terminal, its name goes to stderr
+ *	-u	link on this tty instead of stdin/stdout
+ *	-f	flash image file, created if need be
+ *
+ *  jmi
+ *------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "hal.h"
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-v] [-p | -u device] [-f image]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *pty;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "vpu:f:h")) != -1)
+	{
+		switch (opt)
+		{
+			case 'v':
+				host_clock_virtual();
+				break;
+			case 'p':
+				if ((pty = host_uart_pty()) == 0)
+				{
+					perror("host: pseudo terminal");
+					return 1;
+				}
+				fprintf(stderr, "host: link on %s\n", pty);
+				break;
+			case 'u':
+				if (!host_uart_open(optarg))
+				{
+					perror(optarg);
+					return 1;
+				}
+				break;
+			case 'f':
+				if (!host_flash_image(optarg))
+				{
+					perror(optarg);
+					return 1;
+				}
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	return firmware_main();
+}
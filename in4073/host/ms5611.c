@@ -0,0 +1,93 @@
+/*------------------------------------------------------------------
+ *  ms5611.c -- the barometer on the i2c bus of the host build
+ *
+ *  the PROM has the coefficients of the datasheet example. a
+ *  conversion command latches the raw D1 or D2 for the pressure and
+ *  temperature last set, worked back through the first order
+ *  compensation drivers/baro.c does, and ADC read gives it.
+ *
+ *  jmi
+ *------------------------------------------------------------------
+ */
+
+#include "in4073.h"
+#include "hal.h"
+
+#define MS5611_ADDR	0x77
+#define MS5611_RESET	0x1E
+#define MS5611_D1	0x40	// up to 0x48 with the oversampling
+#define MS5611_D2	0x50
+#define MS5611_ADC_READ	0x00
+#define MS5611_PROM	0xA0
+
+static const uint16_t ms5611_prom[8] = {0, 40127, 36924, 23317, 23282, 33464, 28312, 0};
+
+static int32_t ms5611_pressure = 101325;
+static int32_t ms5611_temperature = 2000;
+static uint32_t ms5611_adc;
+
+void host_ms5611_set(int32_t pressure, int32_t temperature)
+{
+	ms5611_pressure = pressure;
+	ms5611_temperature = temperature;
+}
+
+static int64_t ms5611_dt(void)
+{
+	return ((int64_t)(ms5611_temperature - 2000) << 23) / ms5611_prom[6];
+}
+
+static uint32_t ms5611_raw(int64_t raw)
+{
+	return raw < 0 ? 0 : raw > 0xFFFFFF ? 0xFFFFFF : raw;
+}
+
+static bool ms5611_command(uint8_t command)
+{
+	int64_t dt = ms5611_dt();
+	int64_t offset = ((int64_t)ms5611_prom[2] << 16) + ((dt * ms5611_prom[4]) >> 7);
+	int64_t sens = ((int64_t)ms5611_prom[1] << 15) + ((dt * ms5611_prom[3]) >> 8);
+
+	if ((command & 0xF0) == MS5611_D1)
+	{
+		ms5611_adc = ms5611_raw(((((int64_t)ms5611_pressure << 15) + offset) << 21) / sens);
+	}
+	else if ((command & 0xF0) == MS5611_D2)
+	{
+		ms5611_adc = ms5611_raw(dt + ((int64_t)ms5611_prom[5] << 8));
+	}
+	else if (command != MS5611_RESET)
+	{
+		return false;
+	}
+	return true;
+}
+
+static bool ms5611_read(uint8_t reg, uint8_t length, uint8_t *data)
+{
+	if (reg == MS5611_ADC_READ && length == 3)
+	{
+		data[0] = ms5611_adc >> 16;
+		data[1] = ms5611_adc >> 8;
+		data[2] = ms5611_adc;
+		return true;
+	}
+	if ((reg & 0xF1) == MS5611_PROM && length == 2)
+	{
+		data[0] = ms5611_prom[(reg >> 1) & 7] >> 8;
+		data[1] = ms5611_prom[(reg >> 1) & 7];
+		return true;
+	}
+	return false;
+}
+
+static const host_i2c_device_t ms5611 = {
+	.address = MS5611_ADDR,
+	.read = ms5611_read,
+	.command = ms5611_command,
+};
+
+void host_ms5611_attach(void)
+{
+	host_i2c_attach(&ms5611);
+}
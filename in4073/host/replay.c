@@ -0,0 +1,426 @@
+/*------------------------------------------------------------------
+ *  replay.c -- a flight log through the host build of the controller
+ *
+ *  replay [-o file] flight.csv
+ *	-o	each replayed record as csv: time, mode, ae[] replayed,
+ *		ae[] recorded, execution time in ns
+ *
+ *  reads the csv of logdecode or of read_flight_data(), capture
+ *  records excepted, and plays the records back at their times on
+ *  the virtual clock, each with what the control loop had then: a
+ *  new sample goes to host_imu_set() with a sensor interrupt, the
+ *  mode and the forces and moments of the control channel to the
+ *  state. a record that repeats the sample of the one before is a
+ *  run of the loop in between samples and raises no interrupt.
+ *
+ *  a record whose forces and moments changed is the state reacting
+ *  to the sticks, it is replayed with calculate_rpm() as the state
+ *  does. any other record of a state with a control loop is replayed
+ *  with control_task(). the other states only move ae[] when they
+ *  are entered, their records hand the recorded ae[] on instead.
+ *
+ *  the summary compares the replayed ae[] with those recorded, the
+ *  largest and rms difference and the first record that differs,
+ *  and times each replayed record on the host clock, less what
+ *  reading that clock costs. the attitude is not compared, it comes
+ *  from the log itself. ae[] can only be compared with the motor
+ *  channel in the log, the forces and moments only follow the
+ *  sticks with the control channel, see CMD_LOG_CHANNEL. the exit
+ *  code is 2 if any ae[] differs and 3 if there was nothing to
+ *  compare, a log without the motor channel proves nothing.
+ *
+ *  jmi
+ *------------------------------------------------------------------
+ */
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "in4073.h"
+#include "states.h"
+#include "protocol/log_format.h"
+#include "hal.h"
+
+#define REPLAY_FIELDS		(3 + LOG_CHANNEL_VALUES + 1)	// flight, time, mode, the channels, capture
+#define REPLAY_GAP_US		1000000		// longer gaps, between flights, are cut to this
+
+// where the channels start in the values of a record
+#define REPLAY_GYRO		0
+#define REPLAY_ACCEL		3
+#define REPLAY_ATTITUDE		6
+#define REPLAY_MOTORS		9
+#define REPLAY_CONTROL		13
+
+typedef struct {
+	uint32_t flight;
+	uint32_t time;
+	uint8_t mode;
+	int32_t v[LOG_CHANNEL_VALUES];
+	uint32_t present;		// one bit per value
+	bool capture;
+} replay_record_t;
+
+typedef struct {
+	const char *name;
+	uint32_t count;
+	uint32_t differ;
+	int32_t max;
+	double sum_sq;
+	uint32_t first_time;		// of the first record that differs
+} replay_diff_t;
+
+static replay_diff_t diff_ae = {"ae[]"};
+static uint32_t *step_ns;
+static uint32_t steps, steps_size;
+static uint32_t records, replayed, sticks, passed, skipped;
+
+/* splits a csv line, empty fields are left out of present */
+static bool replay_parse(char *line, replay_record_t *r)
+{
+	char *field[REPLAY_FIELDS], *p = line, *end;
+	int n = 0, k;
+
+	while (n < REPLAY_FIELDS)
+	{
+		field[n++] = p;
+		if ((p = strchr(p, ',')) == 0)
+		{
+			break;
+		}
+		*p++ = '\0';
+	}
+	if (n != REPLAY_FIELDS)
+	{
+		return false;
+	}
+	r->flight = strtoul(field[0], &end, 10);
+	if (end == field[0])
+	{
+		//the header, or other text of the terminal
+		return false;
+	}
+	r->time = strtoul(field[1], 0, 10);
+	r->mode = strtoul(field[2], 0, 10);
+	r->present = 0;
+	for (k = 0; k < LOG_CHANNEL_VALUES; k++)
+	{
+		r->v[k] = strtol(field[3 + k], &end, 10);
+		if (end != field[3 + k])
+		{
+			r->present |= 1u << k;
+		}
+	}
+	r->capture = strtoul(field[REPLAY_FIELDS - 1], &end, 10) != 0 || end != field[REPLAY_FIELDS - 1];
+	return true;
+}
+
+static bool replay_has(const replay_record_t *r, int first, int count)
+{
+	uint32_t mask = ((1u << count) - 1) << first;
+
+	return (r->present & mask) == mask;
+}
+
+static void replay_compare(replay_diff_t *d, uint32_t time, const int16_t *replayed, const int32_t *recorded, int count)
+{
+	int32_t e, worst = 0;
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		e = abs(replayed[i] - recorded[i]);
+		d->sum_sq += (double)e * e;
+		if (e > worst)
+		{
+			worst = e;
+		}
+	}
+	if (worst && d->differ++ == 0)
+	{
+		d->first_time = time;
+	}
+	if (worst > d->max)
+	{
+		d->max = worst;
+	}
+	d->count += count;
+}
+
+static uint64_t replay_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/* the least time between two readings of the clock */
+static uint32_t replay_clock_cost(void)
+{
+	uint64_t a, b, least = UINT64_MAX;
+	int i;
+
+	for (i = 0; i < 1000; i++)
+	{
+		a = replay_ns();
+		b = replay_ns();
+		if (b - a < least)
+		{
+			least = b - a;
+		}
+	}
+	return least;
+}
+
+static void replay_step(const replay_record_t *r, FILE *out, uint32_t clock_cost)
+{
+	static host_imu_sample_t sample = {.saz = 16384}, last;
+	static int32_t control[5];
+	static bool control_known;
+	uint64_t start, ns;
+	bool moved;
+	int i;
+
+	//the sensor values the log does not have stay as they were
+	if (replay_has(r, REPLAY_GYRO, 3))
+	{
+		sample.sp = r->v[REPLAY_GYRO];
+		sample.sq = r->v[REPLAY_GYRO + 1];
+		sample.sr = r->v[REPLAY_GYRO + 2];
+	}
+	if (replay_has(r, REPLAY_ACCEL, 3))
+	{
+		sample.sax = r->v[REPLAY_ACCEL];
+		sample.say = r->v[REPLAY_ACCEL + 1];
+		sample.saz = r->v[REPLAY_ACCEL + 2];
+	}
+	if (replay_has(r, REPLAY_ATTITUDE, 3))
+	{
+		sample.phi = r->v[REPLAY_ATTITUDE];
+		sample.theta = r->v[REPLAY_ATTITUDE + 1];
+		sample.psi = r->v[REPLAY_ATTITUDE + 2];
+	}
+	//the records of the runs in between samples repeat the last one
+	if (memcmp(&sample, &last, sizeof(sample)) != 0)
+	{
+		host_imu_set(&sample);
+		host_imu_interrupt();
+		last = sample;
+	}
+
+	moved = false;
+	if (replay_has(r, REPLAY_CONTROL, 5))
+	{
+		moved = control_known && memcmp(control, &r->v[REPLAY_CONTROL], sizeof(control)) != 0;
+		memcpy(control, &r->v[REPLAY_CONTROL], sizeof(control));
+		control_known = true;
+		lift_force = control[0];
+		roll_moment = control[1];
+		pitch_moment = control[2];
+		yaw_moment = control[3];
+		p_ctrl = control[4];
+	}
+	cur_mode = r->mode;
+
+	if (!fsm_has_control() && !(moved && cur_mode != SAFE_MODE && cur_mode != PANIC_MODE))
+	{
+		if (replay_has(r, REPLAY_MOTORS, 4))
+		{
+			for (i = 0; i < 4; i++)
+			{
+				ae[i] = r->v[REPLAY_MOTORS + i];
+			}
+		}
+		clear_sensor_int_flag();
+		passed++;
+		return;
+	}
+
+	start = replay_ns();
+	if (moved)
+	{
+		calculate_rpm(lift_force, roll_moment, pitch_moment, yaw_moment);
+	}
+	else
+	{
+		control_task();
+	}
+	ns = replay_ns() - start;
+	ns = ns > clock_cost ? ns - clock_cost : 0;
+	if (moved)
+	{
+		sticks++;
+	}
+	else
+	{
+		replayed++;
+	}
+
+	if (steps == steps_size)
+	{
+		steps_size = steps_size ? 2 * steps_size : 4096;
+		step_ns = realloc(step_ns, steps_size * sizeof(*step_ns));
+	}
+	step_ns[steps++] = ns;
+
+	if (replay_has(r, REPLAY_MOTORS, 4))
+	{
+		replay_compare(&diff_ae, r->time, ae, &r->v[REPLAY_MOTORS], 4);
+	}
+	if (out)
+	{
+		fprintf(out, "%u,%u,%d,%d,%d,%d", r->time, r->mode, ae[0], ae[1], ae[2], ae[3]);
+		for (i = 0; i < 4; i++)
+		{
+			if (replay_has(r, REPLAY_MOTORS, 4))
+			{
+				fprintf(out, ",%d", r->v[REPLAY_MOTORS + i]);
+			}
+			else
+			{
+				fprintf(out, ",");
+			}
+		}
+		fprintf(out, ",%llu\n", (unsigned long long)ns);
+	}
+}
+
+static int by_value(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void replay_report_diff(const replay_diff_t *d)
+{
+	if (d->count == 0)
+	{
+		printf("REPLAY: %s not in the log\n", d->name);
+		return;
+	}
+	printf("REPLAY: %s max %d rms %.3f, %u records differ", d->name, d->max, sqrt(d->sum_sq / d->count), d->differ);
+	if (d->differ)
+	{
+		printf(", the first at %u us", d->first_time);
+	}
+	printf("\n");
+}
+
+static void replay_report(uint32_t clock_cost)
+{
+	uint64_t total = 0;
+	uint32_t i;
+
+	printf("REPLAY: %u records, %u control loop runs, %u stick changes, %u handed on, %u skipped\n",
+		records, replayed, sticks, passed, skipped);
+	replay_report_diff(&diff_ae);
+	if (steps == 0)
+	{
+		return;
+	}
+	for (i = 0; i < steps; i++)
+	{
+		total += step_ns[i];
+	}
+	qsort(step_ns, steps, sizeof(*step_ns), by_value);
+	printf("REPLAY: ns per record min %u median %u p99 %u max %u mean %llu, clock read %u ns taken off\n",
+		step_ns[0], step_ns[steps / 2], step_ns[steps * 99 / 100], step_ns[steps - 1],
+		(unsigned long long)(total / steps), clock_cost);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-o file] flight.csv\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	replay_record_t r;
+	FILE *in, *out = 0;
+	char line[512];
+	uint32_t last_time = 0, last_flight = 0, gap, clock_cost;
+	bool started = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "o:h")) != -1)
+	{
+		switch (opt)
+		{
+			case 'o':
+				if ((out = fopen(optarg, "w")) == 0)
+				{
+					perror(optarg);
+					return 1;
+				}
+				fprintf(out, "time_us,mode,ae0,ae1,ae2,ae3,rec_ae0,rec_ae1,rec_ae2,rec_ae3,ns\n");
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+	{
+		usage(argv[0]);
+	}
+	if ((in = fopen(argv[optind], "r")) == 0)
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+
+	//the parts of initialize() the control loop needs, no watchdog and no tasks
+	host_clock_virtual();
+	timers_init();
+	spi_flash_init();
+	log_init();
+	clock_cost = replay_clock_cost();
+
+	while (fgets(line, sizeof(line), in))
+	{
+		line[strcspn(line, "\r\n")] = '\0';
+		if (!replay_parse(line, &r))
+		{
+			continue;
+		}
+		records++;
+		//capture records go over the time around a trigger once more
+		if (r.capture || r.mode >= MODES)
+		{
+			skipped++;
+			continue;
+		}
+		//at the time it was recorded, as far as the clock goes
+		gap = r.time - last_time;
+		if (started && r.flight == last_flight && gap < REPLAY_GAP_US)
+		{
+			nrf_delay_us(gap);
+		}
+		else if (started)
+		{
+			nrf_delay_us(REPLAY_GAP_US);
+		}
+		started = true;
+		last_time = r.time;
+		last_flight = r.flight;
+		replay_step(&r, out, clock_cost);
+		//as the idle loop would, so the log of the replay does not drop records
+		flush_flight_data();
+	}
+	fclose(in);
+	if (out)
+	{
+		fclose(out);
+	}
+	replay_report(clock_cost);
+	if (diff_ae.count == 0)
+	{
+		fprintf(stderr, "replay: WARNING nothing was checked, log the motor channel\n");
+		return 3;
+	}
+	return diff_ae.differ ? 2 : 0;
+}
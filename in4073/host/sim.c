@@ -0,0 +1,457 @@
+/*------------------------------------------------------------------
+ *  sim.c -- the firmware flying a simulated quadrotor, see hal.h
+ *
+ *  sim [-p | -u device] [-f image] [-c script] [-x speed] [-t seconds] [-s seed] [-l file]
+ *	-p	link on a new pseudo terminal, its name goes to stderr
+ *	-u	link on this tty instead of stdin/stdout
+ *	-f	flash image file, created if need be
+ *	-c	fly this script, lines of "seconds mode lift pitch roll yaw"
+ *		with the sticks from -63 to 63, each held until the next.
+ *		sent as pc_terminal does, so it needs no link
+ *	-x	simulated seconds per real second, 0 (default) as fast as
+ *		the cpu goes. -p -x 1 to fly it with pc_terminal, the link
+ *		runs in real time
+ *	-t	stop after this many simulated seconds
+ *	-s	seed of the sensor noise and biases
+ *	-l	the state every SIM_TRACE_US as csv, for tuning the gains
+ *
+ *  the clock is the virtual one, host_tick() moves the model up to
+ *  the time of each service in steps of at most SIM_STEP_US before
+ *  the firmware gets to read the sensors, then holds back to the
+ *  speed asked for.
+ *
+ *  the model: a rigid body in x forward, y right, z down, motor 0 at
+ *  the front, 1 right, 2 back, 3 left. the esc gives a rotor speed
+ *  in proportion to the pulse above 1ms, the motor follows it with a
+ *  first order lag. thrust and drag torque go with the square of it,
+ *  1 and 3 turn against 0 and 2. linear air drag, and a ground the
+ *  drone rests level on for as long as the thrust is below its weight.
+ *
+ *  the sensors: the MPU6050 sits with x forward, y left and z up, it
+ *  reads +1g on z at rest, and turning right is a negative sr. the
+ *  dmp angles and the gyro are the body's in those axes with white
+ *  noise, the gyro also with a bias. the accelerometer reads all
+ *  forces but gravity, with noise and a bias.
+ *  the barometer reads the standard atmosphere with the noise of the
+ *  MS5611 at the oversampling baro.c uses. the noise densities and
+ *  biases are the typical ones of the MPU6050 datasheet.
+ *
+ *  jmi
+ *------------------------------------------------------------------
+ */
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "protocol/protocol.h"
+#include "hal.h"
+
+#define SIM_STEP_US		1000
+#define SIM_TRACE_US		10000
+#define SIM_G			9.81
+#define SIM_PACKET_US		50000		// pc_terminal sends at 20Hz
+
+// the airframe
+#define SIM_MASS		0.60		// kg
+#define SIM_ARM			0.12		// m, center to rotor
+#define SIM_IXX			4.0e-3		// kg m^2
+#define SIM_IYY			4.0e-3
+#define SIM_IZZ			7.0e-3
+#define SIM_DRAG		0.10		// N per m/s
+#define SIM_ANGULAR_DRAG	2.0e-3		// Nm per rad/s
+
+// the motors, speed in us of pulse above 1ms
+#define SIM_MOTOR_TAU		0.05		// s
+#define SIM_THRUST		4.0e-6		// N per us^2, 4N at full pulse
+#define SIM_TORQUE		(SIM_THRUST * 0.016)	// Nm per us^2
+
+// the sensors, in the units of hal.h
+#define SIM_ANGLE_LSB		10430.0		// per rad
+#define SIM_GYRO_LSB		(16.4 * 180.0 / M_PI)	// per rad/s
+#define SIM_ACCEL_LSB		(16384.0 / SIM_G)	// per m/s^2
+#define SIM_DMP_BANDWIDTH	100.0		// Hz, each sample averages over that
+#define SIM_ANGLE_NOISE		(0.05 * M_PI / 180.0)	// rad rms
+#define SIM_GYRO_DENSITY	(0.005 * M_PI / 180.0)	// rad/s per sqrt(Hz)
+#define SIM_GYRO_BIAS		(2.0 * M_PI / 180.0)	// rad/s, at most
+#define SIM_ACCEL_DENSITY	(400e-6 * SIM_G)	// m/s^2 per sqrt(Hz)
+#define SIM_ACCEL_BIAS		(50e-3 * SIM_G)		// m/s^2, at most
+#define SIM_PRESSURE_NOISE	1.2		// Pa rms, D1 at OSR 4096
+#define SIM_TEMPERATURE		2000		// 0.01 C
+#define SIM_TEMPERATURE_NOISE	0.5		// 0.01 C rms, D2 at OSR 1024
+
+typedef struct {
+	uint64_t us;
+	uint8_t mode;
+	int8_t lift, pitch, roll, yaw;
+} sim_command_t;
+
+typedef struct {
+	double pos[3], vel[3];		// earth axes, m and m/s
+	double att[3];			// phi, theta, psi in rad
+	double rate[3];			// p, q, r in rad/s
+	double motor[4];		// us above 1ms
+	double accel[3];		// body axes, last step
+} sim_state_t;
+
+static sim_state_t sim;
+static double gyro_bias[3], accel_bias[3];
+static uint64_t sim_us;
+static uint64_t sim_end_us = UINT64_MAX;
+static double sim_speed;
+static struct timespec sim_start;
+static FILE *sim_trace;
+static uint64_t sim_trace_us;
+static uint64_t sim_steps;
+static double sim_max_altitude;
+static sim_command_t *sim_script;
+static int sim_script_count;
+static int sim_script_next;
+static uint64_t sim_packet_us;
+
+static uint64_t sim_rand_state = 0x9E3779B97F4A7C15ull;
+
+/* xorshift64*, the same noise for the same seed on every host */
+static double sim_uniform(void)
+{
+	sim_rand_state ^= sim_rand_state >> 12;
+	sim_rand_state ^= sim_rand_state << 25;
+	sim_rand_state ^= sim_rand_state >> 27;
+	return ((sim_rand_state * 0x2545F4914F6CDD1Dull) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double sim_gauss(double sigma)
+{
+	double u = sim_uniform();
+
+	//box-muller, u is never 1 so 1 - u never 0
+	return sigma * sqrt(-2.0 * log(1.0 - u)) * cos(2.0 * M_PI * sim_uniform());
+}
+
+static int16_t sim_lsb(double value, double lsb)
+{
+	double v = round(value * lsb);
+
+	return v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : (int16_t)v;
+}
+
+/* body to earth rotation of the zyx euler angles */
+static void sim_rotation(const double *att, double r[3][3])
+{
+	double cf = cos(att[0]), sf = sin(att[0]);
+	double ct = cos(att[1]), st = sin(att[1]);
+	double cp = cos(att[2]), sp = sin(att[2]);
+
+	r[0][0] = ct * cp;	r[0][1] = sf * st * cp - cf * sp;	r[0][2] = cf * st * cp + sf * sp;
+	r[1][0] = ct * sp;	r[1][1] = sf * st * sp + cf * cp;	r[1][2] = cf * st * sp - sf * cp;
+	r[2][0] = -st;		r[2][1] = sf * ct;			r[2][2] = cf * ct;
+}
+
+static double sim_wrap(double angle)
+{
+	return remainder(angle, 2.0 * M_PI);
+}
+
+static void sim_step(double dt)
+{
+	double r[3][3], thrust[4], force[3], moment[3], lag, total, tp;
+	int i;
+
+	lag = 1.0 - exp(-dt / SIM_MOTOR_TAU);
+	total = 0;
+	for (i = 0; i < 4; i++)
+	{
+		sim.motor[i] += (host_motor(i) - 1000 - sim.motor[i]) * lag;
+		if (sim.motor[i] < 0)
+		{
+			sim.motor[i] = 0;
+		}
+		thrust[i] = SIM_THRUST * sim.motor[i] * sim.motor[i];
+		total += thrust[i];
+	}
+	moment[0] = SIM_ARM * (thrust[3] - thrust[1]) - SIM_ANGULAR_DRAG * sim.rate[0];
+	moment[1] = SIM_ARM * (thrust[0] - thrust[2]) - SIM_ANGULAR_DRAG * sim.rate[1];
+	moment[2] = SIM_TORQUE / SIM_THRUST * (thrust[1] + thrust[3] - thrust[0] - thrust[2]) -
+		SIM_ANGULAR_DRAG * sim.rate[2];
+
+	//thrust along -z of the body, drag and gravity in earth axes
+	sim_rotation(sim.att, r);
+	for (i = 0; i < 3; i++)
+	{
+		force[i] = -r[i][2] * total - SIM_DRAG * sim.vel[i];
+	}
+	force[2] += SIM_MASS * SIM_G;
+
+	//the accelerometer feels all but gravity, in body axes
+	for (i = 0; i < 3; i++)
+	{
+		sim.accel[i] = (r[0][i] * force[0] + r[1][i] * force[1] + r[2][i] * (force[2] - SIM_MASS * SIM_G)) / SIM_MASS;
+	}
+
+	if (sim.pos[2] >= 0 && force[2] >= 0)
+	{
+		//on the ground, held up by it
+		sim.pos[2] = 0;
+		for (i = 0; i < 3; i++)
+		{
+			sim.vel[i] = 0;
+			sim.rate[i] = 0;
+			sim.accel[i] = 0;
+		}
+		sim.att[0] = sim.att[1] = 0;
+		sim.accel[2] = -SIM_G;
+		return;
+	}
+
+	for (i = 0; i < 3; i++)
+	{
+		sim.pos[i] += sim.vel[i] * dt;
+		sim.vel[i] += force[i] / SIM_MASS * dt;
+	}
+	if (sim.pos[2] > 0)
+	{
+		sim.pos[2] = 0;
+		sim.vel[2] = 0;
+	}
+
+	//euler's equations, then the rates of the angles
+	sim.rate[0] += (moment[0] + (SIM_IYY - SIM_IZZ) * sim.rate[1] * sim.rate[2]) / SIM_IXX * dt;
+	sim.rate[1] += (moment[1] + (SIM_IZZ - SIM_IXX) * sim.rate[2] * sim.rate[0]) / SIM_IYY * dt;
+	sim.rate[2] += (moment[2] + (SIM_IXX - SIM_IYY) * sim.rate[0] * sim.rate[1]) / SIM_IZZ * dt;
+	tp = tan(sim.att[1]);
+	sim.att[0] += (sim.rate[0] + (sim.rate[1] * sin(sim.att[0]) + sim.rate[2] * cos(sim.att[0])) * tp) * dt;
+	sim.att[1] += (sim.rate[1] * cos(sim.att[0]) - sim.rate[2] * sin(sim.att[0])) * dt;
+	sim.att[2] += (sim.rate[1] * sin(sim.att[0]) + sim.rate[2] * cos(sim.att[0])) / cos(sim.att[1]) * dt;
+	//past 90 degrees of pitch the angles no longer describe it, it has crashed by then anyway
+	sim.att[1] = fmax(fmin(sim.att[1], 1.5), -1.5);
+	sim.att[0] = sim_wrap(sim.att[0]);
+	sim.att[2] = sim_wrap(sim.att[2]);
+}
+
+static void sim_sensors(void)
+{
+	host_imu_sample_t s;
+	double gyro_noise = SIM_GYRO_DENSITY * sqrt(SIM_DMP_BANDWIDTH);
+	double accel_noise = SIM_ACCEL_DENSITY * sqrt(SIM_DMP_BANDWIDTH);
+	double altitude = -sim.pos[2];
+	double pressure;
+
+	//y and z of the body turned over into those of the sensor
+	s.phi = sim_lsb(sim_wrap(sim.att[0] + sim_gauss(SIM_ANGLE_NOISE)), SIM_ANGLE_LSB);
+	s.theta = sim_lsb(-sim.att[1] + sim_gauss(SIM_ANGLE_NOISE), SIM_ANGLE_LSB);
+	s.psi = sim_lsb(sim_wrap(-sim.att[2] + sim_gauss(SIM_ANGLE_NOISE)), SIM_ANGLE_LSB);
+	s.sp = sim_lsb(sim.rate[0] + gyro_bias[0] + sim_gauss(gyro_noise), SIM_GYRO_LSB);
+	s.sq = sim_lsb(-sim.rate[1] + gyro_bias[1] + sim_gauss(gyro_noise), SIM_GYRO_LSB);
+	s.sr = sim_lsb(-sim.rate[2] + gyro_bias[2] + sim_gauss(gyro_noise), SIM_GYRO_LSB);
+	s.sax = sim_lsb(sim.accel[0] + accel_bias[0] + sim_gauss(accel_noise), SIM_ACCEL_LSB);
+	s.say = sim_lsb(-sim.accel[1] + accel_bias[1] + sim_gauss(accel_noise), SIM_ACCEL_LSB);
+	s.saz = sim_lsb(-sim.accel[2] + accel_bias[2] + sim_gauss(accel_noise), SIM_ACCEL_LSB);
+	host_imu_set(&s);
+
+	//the standard atmosphere, sea level at 101325 Pa
+	pressure = 101325.0 * pow(1.0 - 2.25577e-5 * altitude, 5.25588);
+	host_ms5611_set(lround(pressure + sim_gauss(SIM_PRESSURE_NOISE)),
+		lround(SIM_TEMPERATURE + sim_gauss(SIM_TEMPERATURE_NOISE)));
+}
+
+static void sim_trace_line(void)
+{
+	fprintf(sim_trace, "%.3f,%.3f,%.3f,%.3f,%.2f,%.2f,%.2f,%.1f,%.1f,%.1f,%.1f\n", sim_us / 1e6,
+		sim.pos[0], sim.pos[1], -sim.pos[2],
+		sim.att[0] * 180.0 / M_PI, sim.att[1] * 180.0 / M_PI, sim.att[2] * 180.0 / M_PI,
+		sim.motor[0], sim.motor[1], sim.motor[2], sim.motor[3]);
+}
+
+static bool sim_script_load(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char line[128];
+	double seconds;
+	int mode, lift, pitch, roll, yaw;
+
+	if (f == 0)
+	{
+		return false;
+	}
+	while (fgets(line, sizeof(line), f))
+	{
+		if (sscanf(line, "%lf %d %d %d %d %d", &seconds, &mode, &lift, &pitch, &roll, &yaw) != 6)
+		{
+			//comments and empty lines
+			continue;
+		}
+		sim_script = realloc(sim_script, (sim_script_count + 1) * sizeof(*sim_script));
+		sim_script[sim_script_count++] = (sim_command_t){seconds * 1e6, mode, lift, pitch, roll, yaw};
+	}
+	fclose(f);
+	return true;
+}
+
+/* the packet of the line that holds now, as pc_terminal frames it */
+static void sim_script_send(void)
+{
+	sim_command_t c = {0};
+	uint8_t f[PACKET_SIZE];
+
+	while (sim_script_next < sim_script_count && sim_script[sim_script_next].us <= sim_us)
+	{
+		sim_script_next++;
+	}
+	if (sim_script_next > 0)
+	{
+		c = sim_script[sim_script_next - 1];
+	}
+	f[0] = HEADER_VALUE;
+	f[1] = c.mode & 0x7F;
+	f[2] = 0;
+	f[3] = c.lift & 0x7F;
+	f[4] = c.pitch & 0x7F;
+	f[5] = c.roll & 0x7F;
+	f[6] = c.yaw & 0x7F;
+	f[7] = frame_checksum(f, PACKET_SIZE);
+	host_uart_receive(f, PACKET_SIZE);
+}
+
+static double sim_real_s(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (t.tv_sec - sim_start.tv_sec) + (t.tv_nsec - sim_start.tv_nsec) / 1e9;
+}
+
+static void sim_summary(void)
+{
+	double real = sim_real_s();
+
+	fflush(stdout);
+	fprintf(stderr, "sim: %.3f s simulated in %.3f s, %.1f times real time, %llu steps, %.2f m at the highest\n",
+		sim_us / 1e6, real, real > 0 ? sim_us / 1e6 / real : 0, (unsigned long long)sim_steps, sim_max_altitude);
+}
+
+/* from host_service(), before the firmware sees the peripherals */
+static void sim_tick(uint64_t now_us)
+{
+	uint64_t dt;
+	double ahead;
+	struct timespec pause;
+
+	while (sim_us < now_us)
+	{
+		dt = now_us - sim_us < SIM_STEP_US ? now_us - sim_us : SIM_STEP_US;
+		sim_step(dt / 1e6);
+		sim_us += dt;
+		sim_steps++;
+		if (-sim.pos[2] > sim_max_altitude)
+		{
+			sim_max_altitude = -sim.pos[2];
+		}
+		if (sim_trace && sim_us >= sim_trace_us)
+		{
+			sim_trace_line();
+			sim_trace_us += SIM_TRACE_US;
+		}
+	}
+	sim_sensors();
+	if (sim_script && sim_us >= sim_packet_us)
+	{
+		sim_script_send();
+		sim_packet_us = sim_us + SIM_PACKET_US;
+	}
+
+	if (sim_us >= sim_end_us)
+	{
+		exit(0);
+	}
+	if (sim_speed > 0)
+	{
+		ahead = sim_us / 1e6 / sim_speed - sim_real_s();
+		if (ahead > 0)
+		{
+			pause.tv_sec = ahead;
+			pause.tv_nsec = (ahead - pause.tv_sec) * 1e9;
+			nanosleep(&pause, 0);
+		}
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-p | -u device] [-f image] [-c script] [-x speed] [-t seconds] [-s seed] [-l file]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *pty;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "pu:f:c:x:t:s:l:h")) != -1)
+	{
+		switch (opt)
+		{
+			case 'p':
+				if ((pty = host_uart_pty()) == 0)
+				{
+					perror("sim: pseudo terminal");
+					return 1;
+				}
+				fprintf(stderr, "sim: link on %s\n", pty);
+				break;
+			case 'u':
+				if (!host_uart_open(optarg))
+				{
+					perror(optarg);
+					return 1;
+				}
+				break;
+			case 'f':
+				if (!host_flash_image(optarg))
+				{
+					perror(optarg);
+					return 1;
+				}
+				break;
+			case 'c':
+				if (!sim_script_load(optarg))
+				{
+					perror(optarg);
+					return 1;
+				}
+				break;
+			case 'x':
+				sim_speed = atof(optarg);
+				break;
+			case 't':
+				sim_end_us = atof(optarg) * 1e6;
+				break;
+			case 's':
+				sim_rand_state ^= strtoull(optarg, 0, 0) * 0xBF58476D1CE4E5B9ull;
+				break;
+			case 'l':
+				if ((sim_trace = fopen(optarg, "w")) == 0)
+				{
+					perror(optarg);
+					return 1;
+				}
+				fprintf(sim_trace, "t,x,y,altitude,phi,theta,psi,motor0,motor1,motor2,motor3\n");
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+
+	for (i = 0; i < 3; i++)
+	{
+		gyro_bias[i] = (2 * sim_uniform() - 1) * SIM_GYRO_BIAS;
+		accel_bias[i] = (2 * sim_uniform() - 1) * SIM_ACCEL_BIAS;
+	}
+	sim_sensors();
+	clock_gettime(CLOCK_MONOTONIC, &sim_start);
+	atexit(sim_summary);
+	host_clock_virtual();
+	host_tick = sim_tick;
+	return firmware_main();
+}
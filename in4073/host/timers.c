@@ -0,0 +1,191 @@
+/*------------------------------------------------------------------
+ *  timers.c -- the clock and the waits of the host build, see hal.h
+ *
+ *  by default the clock is the monotonic clock of the host, the
+ *  waits sleep and the link is served as the bytes come in. with
+ *  host_clock_virtual() the clock only moves when the firmware waits,
+ *  a wait jumps straight to the next event, so a run takes as long
+ *  as the cpu needs for it. each reading of the virtual clock adds
+ *  HOST_CLOCK_READ_US, a busy wait on get_time_us() still ends. a
+ *  loop that never waits still reads the clock, which services the
+ *  peripherals as an interrupt would when an event is due, or at
+ *  least every HOST_BUSY_SERVICE_US.
+ *
+ *  jmi
+ *------------------------------------------------------------------
+ */
+
+#define _GNU_SOURCE
+#include <poll.h>
+#include <time.h>
+#include "in4073.h"
+#include "nrf_soc.h"
+#include "profile.h"
+#include "hal.h"
+
+#define HOST_CLOCK_READ_US	1
+#define HOST_WAKE_MAX_US	0x10000		// TIMER2 is 16 bits
+#define HOST_BUSY_SERVICE_US	1000
+
+void (*host_tick)(uint64_t now_us);
+
+static bool clock_virtual;
+static uint64_t virtual_us;
+static struct timespec clock_start;
+static uint64_t wake_us;
+static uint64_t service_us;
+static bool servicing;
+
+void host_clock_virtual(void)
+{
+	clock_virtual = true;
+}
+
+uint64_t host_time_us(void)
+{
+	struct timespec t;
+
+	if (clock_virtual)
+	{
+		return virtual_us;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)(t.tv_sec - clock_start.tv_sec) * 1000000 + (t.tv_nsec - clock_start.tv_nsec) / 1000;
+}
+
+void timers_init(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &clock_start);
+	virtual_us = 0;
+	wake_us = HOST_WAKE_MAX_US;
+	service_us = 0;
+}
+
+/* the next event of a peripheral, or the next service of a busy loop */
+static uint64_t host_next_us(uint64_t until)
+{
+	uint64_t next = until;
+
+	if (host_imu_next_us() < next)
+	{
+		next = host_imu_next_us();
+	}
+	if (host_flash_next_us() < next)
+	{
+		next = host_flash_next_us();
+	}
+	if (host_board_next_us() < next)
+	{
+		next = host_board_next_us();
+	}
+	return next;
+}
+
+uint64_t now_us64(void)
+{
+	uint64_t now;
+
+	if (clock_virtual)
+	{
+		virtual_us += HOST_CLOCK_READ_US;
+	}
+	now = host_time_us();
+	if (now >= host_next_us(service_us))
+	{
+		host_service();
+		now = host_time_us();
+	}
+	return now;
+}
+
+uint32_t get_time_us(void)
+{
+	return now_us64();
+}
+
+/* the low 16 bits decide, as with CC[1] on the drone */
+void timer_wake_at(uint32_t time_us)
+{
+	uint64_t now = host_time_us();
+	uint32_t ahead = (time_us - (uint32_t)now) & 0xffff;
+
+	wake_us = now + (ahead ? ahead : HOST_WAKE_MAX_US);
+}
+
+uint16_t profile_now(void)
+{
+	return host_time_us();
+}
+
+/* what the interrupt handlers would have done by now */
+void host_service(void)
+{
+	if (servicing)
+	{
+		return;
+	}
+	//interrupts do not nest either
+	servicing = true;
+	service_us = host_time_us() + HOST_BUSY_SERVICE_US;
+	if (host_tick)
+	{
+		host_tick(host_time_us());
+	}
+	host_uart_service();
+	host_imu_service();
+	host_flash_service();
+	host_board_service();
+	fflush(stdout);
+	servicing = false;
+}
+
+/* sleeps until the next peripheral event, input on the link or until */
+static void host_wait(uint64_t until)
+{
+	uint64_t now = host_time_us();
+	uint64_t next = host_next_us(until);
+	struct pollfd fd = {.fd = host_uart_fd(), .events = POLLIN};
+	struct timespec timeout;
+
+	if (next > now)
+	{
+		if (clock_virtual)
+		{
+			virtual_us = next;
+		}
+		else
+		{
+			timeout.tv_sec = (next - now) / 1000000;
+			timeout.tv_nsec = (next - now) % 1000000 * 1000;
+			ppoll(&fd, fd.fd >= 0 ? 1 : 0, &timeout, 0);
+		}
+	}
+	host_service();
+}
+
+/* __WFE(), back after the first event */
+void host_idle(void)
+{
+	host_wait(wake_us);
+}
+
+uint32_t sd_app_evt_wait(void)
+{
+	host_idle();
+	return NRF_SUCCESS;
+}
+
+void nrf_delay_us(uint32_t us)
+{
+	uint64_t until = host_time_us() + us;
+
+	while (host_time_us() < until)
+	{
+		host_wait(until);
+	}
+}
+
+void nrf_delay_ms(uint32_t ms)
+{
+	nrf_delay_us(ms * 1000);
+}
@@ -0,0 +1,76 @@
+/*------------------------------------------------------------------
+ *  twi.c -- the i2c bus of the host build, see hal.h
+ *
+ *  each transfer goes to the device attached at its address. as in
+ *  drivers/twi.c the calls give 0 when the transfer went through. a
+ *  nack, or no device, gives -1 here where the drone would hang.
+ *
+ *  jmi
+ *------------------------------------------------------------------
+ */
+
+#include "in4073.h"
+#include "hal.h"
+
+#define HOST_I2C_DEVICES	4
+
+static const host_i2c_device_t *i2c_devices[HOST_I2C_DEVICES];
+
+bool host_i2c_attach(const host_i2c_device_t *device)
+{
+	int i;
+
+	for (i = 0; i < HOST_I2C_DEVICES; i++)
+	{
+		if (i2c_devices[i] == 0 || i2c_devices[i]->address == device->address)
+		{
+			i2c_devices[i] = device;
+			return true;
+		}
+	}
+	return false;
+}
+
+static const host_i2c_device_t *i2c_device(uint8_t address)
+{
+	int i;
+
+	for (i = 0; i < HOST_I2C_DEVICES && i2c_devices[i]; i++)
+	{
+		if (i2c_devices[i]->address == address)
+		{
+			return i2c_devices[i];
+		}
+	}
+	return 0;
+}
+
+//the barometer is on the board, the mpu is served by imu.c
+void twi_init(void)
+{
+	host_ms5611_attach();
+}
+
+bool i2c_read(uint8_t slave_addr, uint8_t reg_addr, uint8_t data_length, uint8_t *data)
+{
+	const host_i2c_device_t *d = i2c_device(slave_addr);
+
+	if (!data_length || !d || !d->read || !d->read(reg_addr, data_length, data)) return -1;
+	return 0;
+}
+
+bool i2c_write(uint8_t slave_addr, uint8_t reg_addr, uint8_t data_length, uint8_t const *data)
+{
+	const host_i2c_device_t *d = i2c_device(slave_addr);
+
+	if (!data_length || !d || !d->write || !d->write(reg_addr, data_length, data)) return -1;
+	return 0;
+}
+
+bool i2c_command(uint8_t slave_addr, uint8_t command)
+{
+	const host_i2c_device_t *d = i2c_device(slave_addr);
+
+	if (!d || !d->command || !d->command(command)) return -1;
+	return 0;
+}
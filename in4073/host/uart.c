@@ -0,0 +1,133 @@
+/*------------------------------------------------------------------
+ *  uart.c -- the link of the host build, see hal.h
+ *
+ *  printf() and uart_put() both go to stdout, flushed each time the
+ *  peripherals are serviced. received bytes go to rx_queue as the
+ *  interrupt handler puts them there, only as many as fit, the rest
+ *  waits in the host's buffer. stdin and stdout by default, or both
+ *  on a tty or a pseudo terminal, with stdout moved onto it.
+ *
+ *  jmi
+ *------------------------------------------------------------------
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+#include "in4073.h"
+#include "states.h"
+#include "hal.h"
+
+queue rx_queue;
+queue tx_queue;
+
+static int uart_fd = STDIN_FILENO;
+
+static void uart_use(int fd)
+{
+	struct termios t;
+
+	if (tcgetattr(fd, &t) == 0)
+	{
+		cfmakeraw(&t);
+		tcsetattr(fd, TCSANOW, &t);
+	}
+	//nobody may be listening, output is dropped rather than waited for
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fflush(stdout);
+	dup2(fd, STDOUT_FILENO);
+	uart_fd = fd;
+}
+
+bool host_uart_open(const char *path)
+{
+	int fd = open(path, O_RDWR | O_NOCTTY);
+
+	if (fd < 0)
+	{
+		return false;
+	}
+	uart_use(fd);
+	return true;
+}
+
+const char *host_uart_pty(void)
+{
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+	if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0)
+	{
+		return 0;
+	}
+	//with the other end held open the link does not hang up between pc_terminal runs
+	if (open(ptsname(fd), O_RDWR | O_NOCTTY) < 0)
+	{
+		return 0;
+	}
+	uart_use(fd);
+	return ptsname(fd);
+}
+
+int host_uart_fd(void)
+{
+	return uart_fd;
+}
+
+void uart_init(void)
+{
+	init_queue(&rx_queue);
+	init_queue(&tx_queue);
+	setvbuf(stdout, 0, _IOFBF, BUFSIZ);
+}
+
+void uart_put(uint8_t byte)
+{
+	putchar(byte);
+}
+
+static void uart_received(void)
+{
+	if (rx_queue.count >= 8)
+	{
+		msg = true;
+	}
+}
+
+/* bytes that do not fit are lost, as in an overrun */
+void host_uart_receive(const uint8_t *data, int length)
+{
+	int i;
+
+	for (i = 0; i < length && rx_queue.count < QUEUE_SIZE; i++)
+	{
+		enqueue(&rx_queue, data[i]);
+	}
+	uart_received();
+}
+
+void host_uart_service(void)
+{
+	struct pollfd fd = {.fd = uart_fd, .events = POLLIN};
+	uint8_t buf[QUEUE_SIZE];
+	ssize_t n, i;
+
+	clearerr(stdout);
+	if (uart_fd < 0 || rx_queue.count == QUEUE_SIZE || poll(&fd, 1, 0) <= 0)
+	{
+		return;
+	}
+	n = read(uart_fd, buf, QUEUE_SIZE - rx_queue.count);
+	if (n == 0 && uart_fd == STDIN_FILENO)
+	{
+		//end of the input, nothing more to wait for
+		uart_fd = -1;
+	}
+	for (i = 0; i < n; i++)
+	{
+		enqueue(&rx_queue, buf[i]);
+	}
+	uart_received();
+}
@@ -14,7 +14,10 @@
  */
 #include "in4073.h"
 #include "protocol/protocol.h"
+#include "protocol/log_format.h"
 #include "states.h"
+#include "profile.h"
+#include "isr_stats.h"
 
 #define MAXZ 4000000
 #define MAXL 1000000
@@ -25,6 +28,24 @@
 #define MIN_RPM 179200
 #define MAX_RPM 1000000
 
+bool demo_done;
+uint16_t frames_rx;
+uint16_t checksum_errors;
+packet pc_packet;
+
+//the state and the flags, see states.h
+char cur_mode;
+char p_ctrl;
+char cur_lift, cur_pitch, cur_roll, cur_yaw;
+char old_lift, old_pitch, old_roll, old_yaw;
+int lift_force, roll_moment, pitch_moment, yaw_moment;
+int16_t p_off, q_off, r_off;
+uint32_t time_latest_packet_us, current_time_us;
+bool connection;
+bool battery;
+bool msg;
+bool safe_print;
+
 #define int_to_fixed_point(a) (((int16_t)a)<<8)
 #define divide_fixed_points(a,b) (int)((((int32_t)a<<8)+(b/2))/b)
 #define fixed_point_to_int(a) (int)(a>>8)
@@ -114,6 +135,8 @@ int calculate_N(char yaw)
 void calculate_rpm(int Z, int L, int M, int N)
 {
 	int ae1[4],i;
+
+	PROFILE_BEGIN(PROFILE_MIXER);
 	//if there is lift force calculate ae[] array values
 	if(Z>0)
 	{		
@@ -154,60 +177,86 @@ void calculate_rpm(int Z, int L, int M, int N)
 		ae[2]=0;
 		ae[3]=0;
 	}
+	PROFILE_END(PROFILE_MIXER);
+
 	//update motors
 	run_filters_and_control();
 }
 
+//reads the samples the state itself has no use for, see log_capture()
+static void capture_poll(void)
+{
+	if (check_sensor_int_flag())
+	{
+		get_dmp_data();
+		clear_sensor_int_flag();
+		log_capture();
+	}
+}
+
+//samples taken in calibration mode
+static int clb;
+
+//sums up the gyro samples for the offsets, from the control task
+static void calibration_sample(void)
+{
+	if (clb<200 && check_sensor_int_flag())
+	{
+		get_dmp_data();
+		clear_sensor_int_flag();
+		watchdog_checkin(WATCHDOG_SENSORS);
+		clb++;
+		p_off=p_off+sp;
+		q_off=q_off+sq;
+		r_off=r_off+sq;	
+		log_capture();
+	}
+}
+
 //calibration mode state makis
-void calibration_mode()
-{
-	cur_mode=CALIBRATION_MODE;
-	//indicate that you are in calibration mode
-	nrf_gpio_pin_write(RED,1);
-	nrf_gpio_pin_write(GREEN,0);
-	//counter
-	int clb;
+uint8_t calibration_mode()
+{
+	//take 200 samples, the tasks keep running meanwhile
 	clb=0;
-	//take 200 samples 
 	while(clb<200)
 	{
-		if (check_sensor_int_flag())
-		{
-			get_dmp_data();
-			clear_sensor_int_flag();
-			clb++;
-			p_off=p_off+sp;
-			q_off=q_off+sq;
-			r_off=r_off+sq;	
-		}	
+		sched_run();
 	}
 	//calculate the offset
 	p_off=p_off/200;
 	q_off=q_off/200;
 	r_off=r_off/200;
 	
+	//no input was read meanwhile, judge the link from here on
+	time_latest_packet_us=get_time_us();
+
 	//check the messages
 	process_input();
-	switch (pc_packet.mode)	
-	{
-		case SAFE_MODE:
-			statefunc=safe_mode;
-			break;
-		default:
-			break;
-	}
+	return pc_packet.mode;
 }
 
 
-void yaw_control_mode()
+//yaw rate control on each new sample, from the control task
+static void yaw_control(void)
 {
+	int N;
 
-	cur_mode=YAW_CONTROLLED_MODE;
-
-	nrf_gpio_pin_write(RED,0);
-	nrf_gpio_pin_write(YELLOW,1);
-	nrf_gpio_pin_write(GREEN,0);
+	if (check_sensor_int_flag())
+	{
+		get_dmp_data();
+		clear_sensor_int_flag();
+		watchdog_checkin(WATCHDOG_SENSORS);
+		PROFILE_BEGIN(PROFILE_CONTROL);
+		N=yaw_moment - (yaw_moment-sr*32)*p_ctrl;
+		PROFILE_END(PROFILE_CONTROL);
+		calculate_rpm(lift_force,roll_moment,pitch_moment,N);
+		log_capture();
+		//printf("DRONE SIDE: mode=%d, ae[0]=%d, ae[1]=%d, ae[2]=%d, ae[3]=%d, bat_volt=%d \n",cur_mode,ae[0],ae[1],ae[2],ae[3],bat_volt);
+	}
+}
 
+uint8_t yaw_control_mode()
+{
 	if(old_lift!=cur_lift || old_pitch!=cur_pitch || old_roll!=cur_roll || old_yaw!=cur_yaw)	
 	{
 		lift_force=calculate_Z(cur_lift);
@@ -224,60 +273,19 @@ void yaw_control_mode()
 	}	
 	
 
-	while(msg==false && connection==true)
+	while(msg==false && connection==true && !fsm_event_pending())
 	{
-		check_connection();
-		if (check_sensor_int_flag())
-		{
-			get_dmp_data();				
-			clear_sensor_int_flag();
-			calculate_rpm(lift_force,roll_moment,pitch_moment,yaw_moment - (yaw_moment-sr*32)*p_ctrl);
-			//printf("DRONE SIDE: mode=%d, ae[0]=%d, ae[1]=%d, ae[2]=%d, ae[3]=%d, bat_volt=%d \n",cur_mode,ae[0],ae[1],ae[2],ae[3],bat_volt);
-		}
+		sched_run();
 	}
 	
 	process_input();
-	switch (pc_packet.mode)	
-	{
-		case PANIC_MODE:
-			statefunc=panic_mode;
-			break;
-		case YAW_CONTROLLED_MODE:
-			cur_lift=pc_packet.lift;
-			cur_pitch=pc_packet.pitch;
-			cur_roll=pc_packet.roll;
-			cur_yaw=pc_packet.yaw;
-			if(pc_packet.p_adjust==1)
-			{
-				p_ctrl=p_ctrl+1;
-			}
-			if(pc_packet.p_adjust==2)
-			{
-				p_ctrl=p_ctrl-1;
-				if(p_ctrl<=1)
-				{
-					p_ctrl=1;
-				}
-			}
-		default:
-			break;
-	}
-
-
-	
-
+	return pc_packet.mode;
 }
 
 
 //manual mode state makis
-void manual_mode()
+uint8_t manual_mode()
 {
-	cur_mode=MANUAL_MODE;
-
-	//indicate that you are in manual mode
-	nrf_gpio_pin_write(RED,1);
-	nrf_gpio_pin_write(YELLOW,0);
-
 	//if there is a new command do the calculations
 	if(old_lift!=cur_lift || old_pitch!=cur_pitch || old_roll!=cur_roll || old_yaw!=cur_yaw)	
 	{
@@ -294,39 +302,24 @@ void manual_mode()
 		printf("DRONE SIDE: mode=%d, ae[0]=%d, ae[1]=%d, ae[2]=%d, ae[3]=%d, bat_volt=%d \n",cur_mode,ae[0],ae[1],ae[2],ae[3],bat_volt);
 	}	
 
-	//while there is no message received wait here and check your connection	
-	while(msg==false && connection==true)
+	//while there is no message received wait here, the tasks check your connection
+	while(msg==false && connection==true && !fsm_event_pending())
 	{
-		check_connection();
+		sched_run();
 	}
 
 	//read the new messages to come
 	process_input();
-	switch (pc_packet.mode)	
-	{
-		case PANIC_MODE:
-			statefunc=panic_mode;
-			break;
-		case MANUAL_MODE:
-			cur_lift=pc_packet.lift;
-			cur_pitch=pc_packet.pitch;
-			cur_roll=pc_packet.roll;
-			cur_yaw=pc_packet.yaw;
-			break;
-		default:
-			break;
-	}
+	return pc_packet.mode;
 }
 
 //panic mode state makis
-void panic_mode()
+uint8_t panic_mode()
 {
-	cur_mode=PANIC_MODE;
+	uint32_t start;
+
+	log_trigger(LOG_TRIGGER_PANIC);
 
-	//indicate that you are in panic mode
-	nrf_gpio_pin_write(RED,0);
-	nrf_gpio_pin_write(YELLOW,0);
-	
 	//fly at minimum rpm
 	if(ae[0]>175 || ae[1]>175 || ae[2]>175 || ae[3]>175) 
 	{
@@ -350,8 +343,12 @@ void panic_mode()
 	//print your changed state
 	printf("DRONE SIDE: mode=%d, ae[0]=%d, ae[1]=%d, ae[2]=%d, ae[3]=%d, bat_volt=%d \n",cur_mode,ae[0],ae[1],ae[2],ae[3],bat_volt);
 
-	//after 2 seconds get to safe mode
-	nrf_delay_ms(2000);
+	//after 2 seconds get to safe mode, the tasks keep running meanwhile
+	start=get_time_us();
+	while(get_time_us()-start < 2000000)
+	{
+		sched_run();
+	}
 
 	//fixes a bug, doesn't care to check connection going to safe mode anyway
 	time_latest_packet_us=get_time_us();
@@ -360,19 +357,12 @@ void panic_mode()
 	safe_print=true;
 
 	//enters safe mode
-	statefunc=safe_mode;
+	return EVENT_DONE;
 }
 
 //safe mode state makis 
-void safe_mode()
+uint8_t safe_mode()
 {
-	cur_mode=SAFE_MODE;	
-
-	//indicate that you are in safe mode	
-	nrf_gpio_pin_write(RED,0);
-	nrf_gpio_pin_write(YELLOW,1);
-	nrf_gpio_pin_write(GREEN,1);
-
 	//motors are shut down
 	ae[0]=0;
 	ae[1]=0;
@@ -385,95 +375,487 @@ void safe_mode()
 		safe_print=false;
 	}
 
-	//while no message is received wait here and check your connection
-	while(msg==false && connection==true)
+	//while no message is received wait here, the tasks check your connection
+	//and feed the watchdog, so run them at least once even with the link down
+	do
 	{
-		
-		check_connection();
+		sched_run();
 	}
+	while(msg==false && !fsm_event_pending());
 	
-	//if there is battery and the connection is ok read the messages
-	if(battery==true && connection==true)
+	//with the link down stay here, otherwise read the messages
+	if(connection==false)
 	{
-		process_input();
-		switch (pc_packet.mode)
+		return EVENT_NONE;
+	}
+	process_input();
+	if(battery==false)
+	{
+		return EVENT_NONE;
+	}
+	return pc_packet.mode;
+}
+
+/*------------------------------------------------------------------
+ * guards and actions of the transitions. an action runs once
+ * cur_mode holds the new state.
+ *------------------------------------------------------------------
+ */
+
+//no switching to a flying mode with offsets different than zero
+static bool sticks_zero(void)
+{
+	return pc_packet.lift==0 && pc_packet.pitch==0 && pc_packet.roll==0 && pc_packet.yaw==0;
+}
+
+static void announce_mode(void)
+{
+	//print your changed state
+	printf("DRONE SIDE: mode=%d, ae[0]=%d, ae[1]=%d, ae[2]=%d, ae[3]=%d, bat_volt=%d \n",cur_mode,ae[0],ae[1],ae[2],ae[3],bat_volt);
+}
+
+static void clear_offsets(void)
+{
+	p_off=0;
+	q_off=0;
+	r_off=0;
+}
+
+static void take_sticks(void)
+{
+	cur_lift=pc_packet.lift;
+	cur_pitch=pc_packet.pitch;
+	cur_roll=pc_packet.roll;
+	cur_yaw=pc_packet.yaw;
+}
+
+static void take_sticks_and_gain(void)
+{
+	take_sticks();
+	if(pc_packet.p_adjust==1)
+	{
+		p_ctrl=p_ctrl+1;
+	}
+	if(pc_packet.p_adjust==2)
+	{
+		p_ctrl=p_ctrl-1;
+		if(p_ctrl<=1)
 		{
-			//check for not switching to manual mode with offsets different than zero
-			case MANUAL_MODE:
-				if(pc_packet.lift==0 && pc_packet.pitch==0 && pc_packet.roll==0 && pc_packet.yaw==0)
-				{
-					//print your changed state
-					printf("DRONE SIDE: mode=%d, ae[0]=%d, ae[1]=%d, ae[2]=%d, ae[3]=%d, bat_volt=%d \n",MANUAL_MODE,ae[0],ae[1],ae[2],ae[3],bat_volt);
-					statefunc=manual_mode;
-				}
-				break;
-			case CALIBRATION_MODE:
-				p_off=0;
-				q_off=0;
-				r_off=0;
-				statefunc=calibration_mode;
-				break;
-			case YAW_CONTROLLED_MODE:
-				if(pc_packet.lift==0 && pc_packet.pitch==0 && pc_packet.roll==0 && pc_packet.yaw==0)
-				{
-					//print your changed state
-					printf("DRONE SIDE: mode=%d, ae[0]=%d, ae[1]=%d, ae[2]=%d, ae[3]=%d, bat_volt=%d \n",YAW_CONTROLLED_MODE,ae[0],ae[1],ae[2],ae[3],bat_volt);
-					statefunc=yaw_control_mode;
-				}
-				break;
-			default:
-				break;
+			p_ctrl=1;
 		}
 	}
 }
 
-/*jmi*/
-char get_checksum(packet p) {	
-	char checksum = (p.header^p.mode^p.p_adjust^p.lift^p.pitch^p.roll^p.yaw) >> 1;
-	return checksum;
+/*------------------------------------------------------------------
+ * flight state machine. the state is cur_mode, one of the modes in
+ * protocol.h. a state is a function for one pass through it, which
+ * returns the mode asked for by the last packet, and the leds it
+ * drives. what an event does in a state is looked up in
+ * transitions[][], an empty entry ignores the event.
+ *------------------------------------------------------------------
+ */
+#define LED_RED		0x01
+#define LED_YELLOW	0x02
+#define LED_GREEN	0x04
+
+typedef struct {
+	uint8_t (*run)(void);
+	uint8_t led_mask;	// leds the state drives, the others stay as they are
+	uint8_t led_high;	// of those, the ones written 1
+	void (*control)(void);	// run by the control task, 0 for none
+} state_t;
+
+typedef struct {
+	bool (*guard)(void);	// 0 always passes
+	void (*action)(void);
+	uint8_t next;
+	bool valid;
+} transition_t;
+
+#define TRANSITION(next, guard, action)	{guard, action, next, true}
+
+static const state_t states[MODES] = {
+	[SAFE_MODE]		= {safe_mode, LED_RED | LED_YELLOW | LED_GREEN, LED_YELLOW | LED_GREEN},
+	[PANIC_MODE]		= {panic_mode, LED_RED | LED_YELLOW, 0},
+	[MANUAL_MODE]		= {manual_mode, LED_RED | LED_YELLOW, LED_RED},
+	[CALIBRATION_MODE]	= {calibration_mode, LED_RED | LED_GREEN, LED_RED, calibration_sample},
+	[YAW_CONTROLLED_MODE]	= {yaw_control_mode, LED_RED | LED_YELLOW | LED_GREEN, LED_YELLOW, yaw_control},
+};
+
+static const transition_t transitions[MODES][EVENTS] = {
+	[SAFE_MODE] = {
+		[MANUAL_MODE]		= TRANSITION(MANUAL_MODE, sticks_zero, announce_mode),
+		[CALIBRATION_MODE]	= TRANSITION(CALIBRATION_MODE, 0, clear_offsets),
+		[YAW_CONTROLLED_MODE]	= TRANSITION(YAW_CONTROLLED_MODE, sticks_zero, announce_mode),
+		[EVENT_LINK_LOST]	= TRANSITION(PANIC_MODE, 0, 0),
+		[EVENT_BATTERY_LOW]	= TRANSITION(PANIC_MODE, 0, 0),
+	},
+	[PANIC_MODE] = {
+		[EVENT_BATTERY_LOW]	= TRANSITION(PANIC_MODE, 0, 0),
+		[EVENT_DONE]		= TRANSITION(SAFE_MODE, 0, 0),
+	},
+	[MANUAL_MODE] = {
+		[PANIC_MODE]		= TRANSITION(PANIC_MODE, 0, 0),
+		[MANUAL_MODE]		= TRANSITION(MANUAL_MODE, 0, take_sticks),
+		[EVENT_LINK_LOST]	= TRANSITION(PANIC_MODE, 0, 0),
+		[EVENT_BATTERY_LOW]	= TRANSITION(PANIC_MODE, 0, 0),
+	},
+	[CALIBRATION_MODE] = {
+		[SAFE_MODE]		= TRANSITION(SAFE_MODE, 0, 0),
+		[EVENT_BATTERY_LOW]	= TRANSITION(PANIC_MODE, 0, 0),
+	},
+	[YAW_CONTROLLED_MODE] = {
+		[PANIC_MODE]		= TRANSITION(PANIC_MODE, 0, 0),
+		[YAW_CONTROLLED_MODE]	= TRANSITION(YAW_CONTROLLED_MODE, 0, take_sticks_and_gain),
+		[EVENT_LINK_LOST]	= TRANSITION(PANIC_MODE, 0, 0),
+		[EVENT_BATTERY_LOW]	= TRANSITION(PANIC_MODE, 0, 0),
+	},
+};
+
+//the last FSM_TRACE_SIZE transitions, see fsm_report()
+#define FSM_TRACE_SIZE	16
+
+typedef struct {
+	uint32_t time_ms;
+	uint8_t from;
+	uint8_t to;
+	uint8_t event;
+} fsm_trace_t;
+
+static fsm_trace_t fsm_trace[FSM_TRACE_SIZE];
+static uint8_t fsm_trace_next;
+static uint16_t fsm_transitions;
+static uint16_t fsm_refused;		// mode requests a guard turned down
+static uint8_t fsm_pending = EVENT_NONE;
+
+static const char *const mode_names[MODES] = {"safe", "panic", "manual", "calibration", "yaw", "full", "raw", "height", "wireless"};
+static const char *const event_names[EVENTS - MODES] = {"link lost", "battery low", "done"};
+
+/*------------------------------------------------------------------
+ * takes the transition for event in the current state. asking for
+ * the mode the drone is in only runs the action, that is not traced
+ *------------------------------------------------------------------
+ */
+void fsm_event(uint8_t event)
+{
+	const transition_t *t;
+	fsm_trace_t *r;
+	uint8_t from = cur_mode;
+
+	if (event >= EVENTS)
+	{
+		return;
+	}
+	t = &transitions[from][event];
+	if (!t->valid)
+	{
+		return;
+	}
+	if (t->guard && !t->guard())
+	{
+		fsm_refused++;
+		return;
+	}
+
+	cur_mode = t->next;
+	if (t->action)
+	{
+		t->action();
+	}
+
+	if (t->next != from || event >= MODES)
+	{
+		r = &fsm_trace[fsm_trace_next];
+		r->time_ms = now_us64() / 1000;
+		r->from = from;
+		r->to = t->next;
+		r->event = event;
+		fsm_trace_next = (fsm_trace_next + 1) % FSM_TRACE_SIZE;
+		fsm_transitions++;
+	}
+}
+
+/* for events noticed in the middle of a state pass, taken at its end */
+void fsm_raise(uint8_t event)
+{
+	fsm_pending = event;
+}
+
+/* the wait loops of the states end the pass early for a raised event */
+bool fsm_event_pending(void)
+{
+	return fsm_pending != EVENT_NONE;
+}
+
+/* the state runs a control loop on each sample, see control_task() */
+bool fsm_has_control(void)
+{
+	return states[(uint8_t)cur_mode].control != 0;
+}
+
+/*------------------------------------------------------------------
+ * one pass through the current state, then the transitions for what
+ * came out of it
+ *------------------------------------------------------------------
+ */
+void fsm_step(void)
+{
+	const state_t *s = &states[(uint8_t)cur_mode];
+	uint8_t event;
+	uint8_t raised;
+	char from;
+
+	if (s->led_mask & LED_RED)
+	{
+		nrf_gpio_pin_write(RED, (s->led_high & LED_RED) != 0);
+	}
+	if (s->led_mask & LED_YELLOW)
+	{
+		nrf_gpio_pin_write(YELLOW, (s->led_high & LED_YELLOW) != 0);
+	}
+	if (s->led_mask & LED_GREEN)
+	{
+		nrf_gpio_pin_write(GREEN, (s->led_high & LED_GREEN) != 0);
+	}
+
+	event = s->run();
+
+	//a raised event is judged in the state that raised it, before the
+	//pass's own result. if it leaves the state that result is stale
+	if (fsm_pending != EVENT_NONE)
+	{
+		raised = fsm_pending;
+		fsm_pending = EVENT_NONE;
+		from = cur_mode;
+		fsm_event(raised);
+		if (cur_mode != from)
+		{
+			return;
+		}
+	}
+	fsm_event(event);
+}
+
+/*------------------------------------------------------------------
+ * prints the transitions in the trace, oldest first
+ *------------------------------------------------------------------
+ */
+void fsm_report(void)
+{
+	fsm_trace_t *r;
+	int i, n;
+
+	n = fsm_transitions < FSM_TRACE_SIZE ? fsm_transitions : FSM_TRACE_SIZE;
+	printf("MODE: %s, %u transitions, %u requests refused\n", mode_names[(uint8_t)cur_mode], fsm_transitions, fsm_refused);
+	for (i = 0; i < n; i++)
+	{
+		r = &fsm_trace[(fsm_trace_next + FSM_TRACE_SIZE - n + i) % FSM_TRACE_SIZE];
+		if (r->event < MODES)
+		{
+			printf("MODE: %lu ms %s -> %s, asked for %s\n", r->time_ms, mode_names[r->from], mode_names[r->to], mode_names[r->event]);
+		}
+		else
+		{
+			printf("MODE: %lu ms %s -> %s, %s\n", r->time_ms, mode_names[r->from], mode_names[r->to], event_names[r->event - MODES]);
+		}
+		nrf_delay_ms(6);
+	}
+}
+
+/*------------------------------------------------------------------
+ * reflects a ping frame, adding the drone side link counters and
+ * the cpu load
+ *------------------------------------------------------------------
+ */
+void send_pong(uint8_t *ping)
+{
+	uint8_t f[PONG_SIZE];
+	int i;
+
+	f[0] = PONG_HEADER;
+	//sequence number and ground timestamp are echoed as is
+	for (i = 1; i < 6; i++)
+	{
+		f[i] = ping[i];
+	}
+	put_septets(&f[6], frames_rx, 2);
+	put_septets(&f[8], checksum_errors, 2);
+	put_septets(&f[10], rx_queue.overruns, 2);
+	put_septets(&f[12], sched_cpu_load(), 2);
+	f[PONG_SIZE-1] = frame_checksum(f, PONG_SIZE);
+
+	for (i = 0; i < PONG_SIZE; i++)
+	{
+		uart_put(f[i]);
+	}
+}
+
+/*------------------------------------------------------------------
+ * one-shot commands from the terminal. they can take a while, so
+ * they are only run while the motors are off
+ *------------------------------------------------------------------
+ */
+void handle_command(uint8_t *f)
+{
+	if (cur_mode != SAFE_MODE)
+	{
+		printf("DRONE SIDE: command %d ignored outside safe mode\n", f[1]);
+		return;
+	}
+
+	switch (f[1])
+	{
+		case CMD_FLASH_BENCH:
+			flash_benchmark();
+			break;
+		case CMD_LOG_STATUS:
+			log_report();
+			break;
+		case CMD_LOG_DUMP:
+			log_dump_start(get_septets(&f[2], 4));
+			break;
+		case CMD_LOG_DUMP_ACK:
+			log_dump_ack(get_septets(&f[2], 4));
+			break;
+		case CMD_LOG_LIST:
+			log_list_sessions();
+			break;
+		case CMD_LOG_SELECT:
+			log_select_session();
+			break;
+		case CMD_LOG_CHANNEL:
+			log_set_channel(get_septets(&f[2], 4));
+			break;
+		case CMD_LOG_TRIGGER:
+			log_trigger(LOG_TRIGGER_COMMAND);
+			break;
+		case CMD_MODE_TRACE:
+			fsm_report();
+			break;
+		case CMD_SCHED_STATUS:
+			sched_report();
+			watchdog_report();
+			isr_report();
+			break;
+		case CMD_PROFILE_DUMP:
+			profile_dump();
+			break;
+		default:
+			break;
+	}
+	//the command may have kept us away from the link for a while
+	time_latest_packet_us = get_time_us();
 }
 
 /*jmi*/
 void process_input() 
 {
-	//temporary package before checksum validation
-	packet tp; 
+	uint8_t f[PACKET_SIZE];
 	char c;
-	if(rx_queue.count>0)
+	int i;
+
+	//cleared first, so a frame completing while we parse sets it again
+	msg=false;
+
+	//only whole frames are taken out of the queue
+	while (rx_queue.count >= PACKET_SIZE)
 	{
-		/*skip through all input untill header is found*/
-		while ( (c = dequeue(&rx_queue) ) != HEADER_VALUE) {
+		//up to the checked frame, what it asks for is not counted
+		PROFILE_BEGIN(PROFILE_PARSER);
+		/*skip through all input untill a header is found*/
+		c = dequeue(&rx_queue);
+		if ((c & 0x80) == 0)
+		{
+			continue;
+		}
+		f[0] = c;
+		for (i = 1; i < PACKET_SIZE; i++)
+		{
+			f[i] = dequeue(&rx_queue);
 		}
-		tp.header = c;
-		tp.mode = dequeue(&rx_queue);		
-		tp.p_adjust = dequeue(&rx_queue);
-		tp.lift = dequeue(&rx_queue);
-		tp.pitch = dequeue(&rx_queue);
-		tp.roll = dequeue(&rx_queue);
-		tp.yaw = dequeue(&rx_queue);
-		tp.checksum = dequeue(&rx_queue);
-		//if checksum is correct,copy whole packet into global packet	
-		if (tp.checksum == (get_checksum(tp) & 0x7F)) {
-			pc_packet.mode = tp.mode;
-			pc_packet.p_adjust = tp.p_adjust;
-			pc_packet.lift = tp.lift;
-			pc_packet.pitch = tp.pitch;
-			pc_packet.roll = tp.roll;
-			pc_packet.yaw = tp.yaw;
-			pc_packet.checksum = tp.checksum;
-			time_latest_packet_us = get_time_us();
-			msg=false;
 
+		if (f[PACKET_SIZE-1] != frame_checksum(f, PACKET_SIZE))
+		{
+			checksum_errors++;
+			continue;
 		}
+		frames_rx++;
+		PROFILE_END(PROFILE_PARSER);
+		time_latest_packet_us = get_time_us();
 
-		/*flush rest of queue*/
-		while (rx_queue.count >= 1) {
-			dequeue(&rx_queue);
+		switch (f[0])
+		{
+			//copy whole packet into global packet
+			case HEADER_VALUE:
+				pc_packet.mode = f[1];
+				pc_packet.p_adjust = f[2];
+				pc_packet.lift = f[3];
+				pc_packet.pitch = f[4];
+				pc_packet.roll = f[5];
+				pc_packet.yaw = f[6];
+				pc_packet.checksum = f[7];
+				break;
+			case PING_HEADER:
+				send_pong(f);
+				break;
+			case CMD_HEADER:
+				handle_command(f);
+				break;
+			default:
+				break;
 		}
 	}
 }
 
 
+/*------------------------------------------------------------------
+ * tasks, see initialize(). the battery is sampled every
+ * TIMER_PERIOD and checked as soon as the sample is in. host/replay.c
+ * runs control_task() on the samples of a flight log
+ *------------------------------------------------------------------
+ */
+void control_task(void)
+{
+	const state_t *s = &states[(uint8_t)cur_mode];
+
+	watchdog_checkin(WATCHDOG_CONTROL);
+	if (s->control)
+	{
+		s->control();
+	}
+	else
+	{
+		//no sensors needed in this state, nothing to be late
+		watchdog_checkin(WATCHDOG_SENSORS);
+		capture_poll();
+	}
+}
+
+static void telemetry_task(void)
+{
+	//a dump only runs while the motors are off
+	if (cur_mode == SAFE_MODE)
+	{
+		log_dump_poll();
+	}
+}
+
+void battery_sampled(void *data, uint16_t size)
+{
+	uint16_t volt = *(uint16_t *)data;
+
+	if (volt < BAT_THRESHOLD)
+	{
+		printf("bat voltage %d below threshold %d",volt,BAT_THRESHOLD);
+		if(battery)
+		{
+			log_trigger(LOG_TRIGGER_BATTERY);
+		}
+		battery=false;
+		fsm_raise(EVENT_BATTERY_LOW);
+	}
+}
+
 void initialize()
 {
 	//message flag initialization
@@ -488,9 +870,17 @@ void initialize()
 	imu_init(true, 100);	
 	baro_init();
 	spi_flash_init();
+	watchdog_init();
+	log_init();
+	sched_init();
+	sched_add("control", control_task, SCHED_CONTROL, 1000, 1000);
+	sched_add("baro", read_baro, SCHED_SENSORS, 2000, 2000);
+	sched_add("link", check_connection, SCHED_HOUSEKEEPING, 5000, 5000);
+	sched_add("battery", adc_request_sample, SCHED_HOUSEKEEPING, TIMER_PERIOD, TIMER_PERIOD);
+	sched_add("telemetry", telemetry_task, SCHED_TELEMETRY, 1000, 0);
+	sched_add("logging", flush_flight_data, SCHED_BACKGROUND, 1000, 0);
 	//ble_init();
 	demo_done = false;
-	adc_request_sample();
 
 	//initialise the pc_packet struct to safe values, just in case
 	pc_packet.mode = SAFE_MODE;
@@ -521,19 +911,28 @@ void initialize()
 	connection=true;
 	safe_print=true;
 	p_ctrl=10;
-	//first get to safe mode
-	statefunc= safe_mode;
+	//first get to safe mode, cur_mode is set above
 }
 
 //if nothing received for over 500ms approximately go to panic mode and exit
 void check_connection()
 {
+	watchdog_checkin(WATCHDOG_LINK);
+	//panic goes to safe mode anyway, the link is looked at again there
+	//calibration reads no input until it is done
+	if(cur_mode==PANIC_MODE || cur_mode==CALIBRATION_MODE)
+	{
+		return;
+	}
+
 	current_time_us=get_time_us();
 	uint32_t diff = current_time_us - time_latest_packet_us;
-	if(diff > 500000)
+	//the link stays lost, panic only once and then wait in safe mode
+	if(diff > 500000 && connection)
 	{	
+		log_trigger(LOG_TRIGGER_LINK);
 		connection=false;
-		statefunc=panic_mode;
+		fsm_raise(EVENT_LINK_LOST);
 	}
 }
 
@@ -552,23 +951,8 @@ int main(void)
 	while (!demo_done)
 	{		
 		
-		//get to the state
-		(*statefunc)();
-
-		//check battery voltage	
-		if (check_timer_flag()) 
-		{
-			clear_timer_flag();
-			adc_request_sample();
-	
-			if (bat_volt < 1050)
-			{
-				printf("bat voltage %d below threshold %d",bat_volt,BAT_THRESHOLD);
-				battery=false;
-				statefunc=panic_mode;
-			}		
-	
-		}
+		//get to the state, the battery is checked by the tasks run in it
+		fsm_step();
 	}	
 	
 	printf("\n\t Goodbye \n\n");
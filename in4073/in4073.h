@@ -31,18 +31,18 @@
 #define MOTOR_2_PIN			25
 #define MOTOR_3_PIN			29
 
-bool demo_done;
+extern bool demo_done;
 
 // Control
-int16_t ae[4];
+extern int16_t ae[4];
 void run_filters_and_control();
 
 // Timers
-#define TIMER_PERIOD	50000 //50000us=50ms=20Hz (MAX 16bit, 65ms)
+#define TIMER_PERIOD	50000 //50000us=50ms=20Hz, battery sampling
 void timers_init(void);
+uint64_t now_us64(void);
 uint32_t get_time_us(void);
-bool check_timer_flag(void);
-void clear_timer_flag(void);
+void timer_wake_at(uint32_t time_us);
 
 // GPIO
 void gpio_init(void);
@@ -55,6 +55,7 @@ typedef struct {
 	uint8_t Data[QUEUE_SIZE];
 	uint8_t first,last;
   	uint8_t count; 
+	uint16_t overruns; // bytes dropped because the queue was full
 } queue;
 void init_queue(queue *q);
 void enqueue(queue *q, char x);
@@ -63,10 +64,12 @@ char dequeue(queue *q);
 // UART
 #define RX_PIN_NUMBER  16
 #define TX_PIN_NUMBER  14
-queue rx_queue;
-queue tx_queue;
+extern queue rx_queue;
+extern queue tx_queue;
 void uart_init(void);
 void uart_put(uint8_t);
+extern uint16_t frames_rx;	// link statistics, reported back to the pc in every pong
+extern uint16_t checksum_errors;
 
 // TWI
 #define TWI_SCL	4
@@ -74,38 +77,107 @@ void uart_put(uint8_t);
 void twi_init(void);
 bool i2c_write(uint8_t slave_addr, uint8_t reg_addr, uint8_t length, uint8_t const *data);
 bool i2c_read(uint8_t slave_addr, uint8_t reg_addr, uint8_t length, uint8_t *data);
+bool i2c_command(uint8_t slave_addr, uint8_t command);
 
 // MPU wrapper
-int16_t phi, theta, psi;
-int16_t sp, sq, sr;
-int16_t sax, say, saz;
-uint8_t sensor_fifo_count;
+extern int16_t phi, theta, psi;
+extern int16_t sp, sq, sr;
+extern int16_t sax, say, saz;
+extern uint8_t sensor_fifo_count;
 void imu_init(bool dmp, uint16_t interrupt_frequency); // if dmp is true, the interrupt frequency is 100Hz - otherwise 32Hz-8kHz
 void get_dmp_data(void);
 void get_raw_sensor_data(void);
 
 // Barometer
-int32_t pressure;
-int32_t temperature;
+extern int32_t pressure;
+extern int32_t temperature;
 void read_baro(void);
 void baro_init(void);
 
 // ADC
-uint16_t bat_volt;
+extern uint16_t bat_volt;
 void adc_init(void);
 void adc_request_sample(void);
+void battery_sampled(void *data, uint16_t size);	// from the scheduler after each sample
 
 // Flash
+#define SPI_COMMAND_MAX	6
+#define SPI_POLL_READY	0x01	// clock out the status after the command until BUSY clears
+#define SPI_QUEUED	0
+#define SPI_DONE	1
+#define SPI_FAILED	2
+typedef struct spi_transfer spi_transfer_t;
+struct spi_transfer {
+	uint8_t command[SPI_COMMAND_MAX];	// opcode and address, sent first
+	uint8_t command_length;
+	uint8_t flags;
+	const uint8_t *tx;		// data after the command, 0 sends zeros
+	uint8_t *rx;			// received data after the command, may be 0
+	uint32_t length;
+	uint32_t timeout_us;		// for SPI_POLL_READY
+	void (*callback)(spi_transfer_t *t);	// from the interrupt, may queue more
+	volatile uint8_t state;
+};
+bool spi_queue(spi_transfer_t *t);
 bool spi_flash_init(void);
 bool flash_chip_erase(void);
+bool flash_sector_erase(uint32_t address);
+bool flash_sector_erase_start(uint32_t address);
+bool flash_busy(void);
+bool flash_wait_ready(uint32_t timeout_us);
 bool flash_write_byte(uint32_t address, uint8_t data);
 bool flash_write_bytes(uint32_t address, uint8_t *data, uint32_t count);
+bool flash_write_start(uint32_t address, const uint8_t *data, uint32_t count, void (*done)(bool ok));
+bool flash_write_pending(void);
 bool flash_read_byte(uint32_t address, uint8_t *buffer);
 bool flash_read_bytes(uint32_t address, uint8_t *buffer, uint32_t count);
+const uint8_t *flash_read_page(uint32_t address);
+bool flash_read_cached(uint32_t address, uint8_t *buffer, uint32_t count);
+void flash_benchmark(void);
+
+// Logging
+void log_init(void);
+bool write_flight_data(void);
+void flush_flight_data(void);
+void sync_flight_data(void);
+bool read_flight_data(void);
+bool erase_flight_data(void);
+void log_report(void);
+void log_list_sessions(void);
+void log_select_session(void);
+void log_set_channel(uint32_t argument);
+void log_trigger(uint8_t cause);
+void log_capture(void);
+void log_dump_start(uint32_t argument);
+void log_dump_ack(uint32_t frames);
+void log_dump_poll(void);
+
+// Scheduler
+#define SCHED_TASKS_MAX		8
+#define SCHED_CONTROL		0	// priorities, highest first
+#define SCHED_SENSORS		1
+#define SCHED_HOUSEKEEPING	2
+#define SCHED_TELEMETRY		3
+#define SCHED_BACKGROUND	4
+void sched_init(void);
+bool sched_add(const char *name, void (*run)(void), uint8_t priority, uint32_t period_us, uint32_t deadline_us);
+void sched_run(void);
+uint16_t sched_cpu_load(void);
+void sched_report(void);
+
+// Watchdog
+#define WATCHDOG_CONTROL	0	// channels that check in
+#define WATCHDOG_SENSORS	1
+#define WATCHDOG_LINK		2
+#define WATCHDOG_CHANNELS	3
+void watchdog_init(void);
+void watchdog_checkin(uint8_t channel);
+void watchdog_supervise(void);
+void watchdog_report(void);
 
 // BLE
-queue ble_rx_queue;
-queue ble_tx_queue;
+extern queue ble_rx_queue;
+extern queue ble_tx_queue;
 void ble_init(void);
 void ble_send(void);
 
@@ -24,6 +24,7 @@
 #include "dmpKey.h"
 #include "dmpmap.h"
 #include "in4073.h"
+#include "profile.h"
 
 /* The following functions must be defined for this platform:
  * i2c_write(unsigned char slave_addr, unsigned char reg_addr,
@@ -1242,6 +1243,8 @@ int dmp_read_fifo(short *gyro, short *accel, long *quat,
     /* Get a packet. */
     if (mpu_read_fifo_stream(dmp.packet_length, fifo_data, more))
         return -1;
+    PROFILE_END(PROFILE_SENSOR_READ);
+    PROFILE_BEGIN(PROFILE_DECODE);
 
     /* Parse DMP packet. */
     if (dmp.feature_mask & (DMP_FEATURE_LP_QUAT | DMP_FEATURE_6X_LP_QUAT)) {
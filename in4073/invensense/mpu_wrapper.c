@@ -9,11 +9,17 @@
  */
 #include <math.h>
 #include "in4073.h"
+#include "profile.h"
 
 #define QUAT_SENS       0x040000000 //1073741824.f //2^30
 #define EPSILON         0.0001f
 #define PI_2            1.57079632679489661923f
 
+int16_t phi, theta, psi;
+int16_t sp, sq, sr;
+int16_t sax, say, saz;
+uint8_t sensor_fifo_count;
+
 void update_euler_from_quaternions(int32_t *quat) 
 {
 	float q[4];
@@ -35,9 +41,13 @@ void get_dmp_data(void)
 	int16_t gyro[3], accel[3], sensors;
 	int32_t quat[4];
 
+	PROFILE_BEGIN(PROFILE_SENSOR_READ);
 	if (!(read_stat = dmp_read_fifo(gyro, accel, quat, NULL, &sensors, &sensor_fifo_count)))
 	{
+		PROFILE_END(PROFILE_DECODE);
+		PROFILE_BEGIN(PROFILE_EULER);
 		update_euler_from_quaternions(quat);
+		PROFILE_END(PROFILE_EULER);
 		sax = accel[0];
 		say = accel[1];
 		saz = accel[2];
@@ -0,0 +1,165 @@
+/*------------------------------------------------------------------
+ *  isr_stats.c -- statistics of the interrupt handlers, see isr_stats.h
+ *
+ *  with the softdevice present the application has priorities 1 and
+ *  3. a handler at 1 waits for no handler at 3, but each one at 1
+ *  delays all the others by as long as it runs. the map isr_report()
+ *  derives puts the handlers that waited longest for their event at
+ *  1, for as long as the longest runs of those at 1 add up to less
+ *  than ISR_LATENCY_BUDGET_US, the rest at 3.
+ *
+ *  jmi
+ *------------------------------------------------------------------
+ */
+
+#include <string.h>
+#include "in4073.h"
+#include "isr_stats.h"
+
+#define ISR_LATENCY_BUDGET_US	10	// 1% of the motor pulse range
+#define ISR_PRIORITY_HIGH	1
+#define ISR_PRIORITY_LOW	3
+
+static const char *const isr_names[ISR_COUNT] = {"uart", "timer1", "timer2", "gpiote", "adc", "twi0", "spi1"};
+static const IRQn_Type isr_irqs[ISR_COUNT] = {UART0_IRQn, TIMER1_IRQn, TIMER2_IRQn, GPIOTE_IRQn, ADC_IRQn,
+	SPI0_TWI0_IRQn, SPI1_TWI1_IRQn};
+
+#ifdef ISR_STATS
+
+typedef struct {
+	uint32_t count;
+	uint32_t total_us;
+	uint16_t max_us;
+	uint16_t latencies;	// runs that knew the time of their event
+	uint16_t max_latency_us;
+} isr_stat_t;
+
+static isr_stat_t isr_stats[ISR_COUNT];
+
+void isr_record(uint8_t isr, uint16_t entry)
+{
+	isr_stat_t *s = &isr_stats[isr];
+	uint16_t us = profile_now() - entry;
+
+	s->count++;
+	s->total_us += us;
+	if (us > s->max_us)
+	{
+		s->max_us = us;
+	}
+}
+
+void isr_latency(uint8_t isr, uint16_t latency_us)
+{
+	isr_stat_t *s = &isr_stats[isr];
+
+	if (s->latencies < 0xFFFF)
+	{
+		s->latencies++;
+	}
+	if (latency_us > s->max_latency_us)
+	{
+		s->max_latency_us = latency_us;
+	}
+}
+
+/* fills in the best priority of each handler, see the top */
+static void isr_priority_map(uint8_t *best)
+{
+	uint32_t high_us = 0;
+	int i, k, latest;
+
+	for (i = 0; i < ISR_COUNT; i++)
+	{
+		best[i] = ISR_PRIORITY_LOW;
+	}
+	for (k = 0; k < ISR_COUNT; k++)
+	{
+		//the latest handler not placed yet
+		latest = -1;
+		for (i = 0; i < ISR_COUNT; i++)
+		{
+			if (best[i] == ISR_PRIORITY_LOW && isr_stats[i].latencies != 0 &&
+				isr_stats[i].max_latency_us > ISR_LATENCY_BUDGET_US &&
+				(latest < 0 || isr_stats[i].max_latency_us > isr_stats[latest].max_latency_us))
+			{
+				latest = i;
+			}
+		}
+		if (latest < 0 || high_us + isr_stats[latest].max_us > ISR_LATENCY_BUDGET_US)
+		{
+			break;
+		}
+		best[latest] = ISR_PRIORITY_HIGH;
+		high_us += isr_stats[latest].max_us;
+	}
+}
+
+/*------------------------------------------------------------------
+ * prints the statistics of each handler with its priority and the
+ * best one, the handlers that held up the late ones, then clears them
+ *------------------------------------------------------------------
+ */
+void isr_report(void)
+{
+	uint8_t best[ISR_COUNT];
+	isr_stat_t *s;
+	int i, k, held;
+
+	isr_priority_map(best);
+	for (i = 0; i < ISR_COUNT; i++)
+	{
+		s = &isr_stats[i];
+		printf("ISR: %-6s runs %6lu mean %4lu us max %5u us", isr_names[i], s->count,
+			s->count ? s->total_us / s->count : 0, s->max_us);
+		if (s->latencies)
+		{
+			printf(" latency %5u us", s->max_latency_us);
+		}
+		else
+		{
+			printf(" latency     - ");
+		}
+		printf(" prio %lu best %u\n", NVIC_GetPriority(isr_irqs[i]), best[i]);
+		nrf_delay_ms(6);
+	}
+
+	for (i = 0; i < ISR_COUNT; i++)
+	{
+		if (isr_stats[i].latencies == 0 || isr_stats[i].max_latency_us <= ISR_LATENCY_BUDGET_US)
+		{
+			continue;
+		}
+		printf("ISR: %s waited up to %u us, held up by", isr_names[i], isr_stats[i].max_latency_us);
+		held = 0;
+		for (k = 0; k < ISR_COUNT; k++)
+		{
+			if (k != i && isr_stats[k].max_us > ISR_LATENCY_BUDGET_US)
+			{
+				printf(" %s (%u us)", isr_names[k], isr_stats[k].max_us);
+				held++;
+			}
+		}
+		//otherwise by the main loop turning interrupts off
+		printf("%s%s\n", held ? "" : " interrupts being off",
+			best[i] == ISR_PRIORITY_HIGH ? "" : ", priority 1 would be over the budget");
+		nrf_delay_ms(6);
+	}
+	memset(isr_stats, 0, sizeof(isr_stats));
+}
+
+#else
+
+void isr_report(void)
+{
+	int i;
+
+	printf("ISR: no statistics in this build, build with -DISR_STATS. priorities:");
+	for (i = 0; i < ISR_COUNT; i++)
+	{
+		printf(" %s %lu", isr_names[i], NVIC_GetPriority(isr_irqs[i]));
+	}
+	printf("\n");
+}
+
+#endif
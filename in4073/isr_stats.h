@@ -0,0 +1,47 @@
+#ifndef ISR_STATS_H__
+#define ISR_STATS_H__
+
+/*------------------------------------------------------------------
+ * isr_stats.h -- duration and latency of the interrupt handlers
+ *
+ * build with -DISR_STATS to have ISR_ENTER() at the top of a handler
+ * and ISR_EXIT() before each way out of it count its runs and keep
+ * the longest. handlers that know when their event came, the timers,
+ * pass that TIMER2 time to ISR_LATENCY() to keep the longest wait
+ * from the event to the handler. isr_report() prints them with the
+ * priorities they would be best at. without it the macros are empty.
+ *------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include "profile.h"
+
+#define ISR_UART	0
+#define ISR_TIMER1	1
+#define ISR_TIMER2	2
+#define ISR_GPIOTE	3
+#define ISR_ADC		4
+#define ISR_TWI0	5
+#define ISR_SPI1	6
+#define ISR_COUNT	7
+
+#ifdef ISR_STATS
+
+void isr_record(uint8_t isr, uint16_t entry);
+void isr_latency(uint8_t isr, uint16_t latency_us);
+
+#define ISR_ENTER(isr)		uint16_t isr_entry = profile_now()
+#define ISR_LATENCY(isr, event)	isr_latency(isr, isr_entry - (uint16_t)(event))
+#define ISR_EXIT(isr)		isr_record(isr, isr_entry)
+
+#else
+
+#define ISR_ENTER(isr)		do {} while (0)
+#define ISR_LATENCY(isr, event)	do {} while (0)
+#define ISR_EXIT(isr)		do {} while (0)
+
+#endif
+
+void isr_report(void);
+
+#endif // ISR_STATS_H__
@@ -1,127 +1,1104 @@
+/*------------------------------------------------------------------
+ *  logging.c -- flight data logging to the spi flash
+ *
+ *  write_flight_data() is called from the control loop and only
+ *  codes a record into the block being filled in RAM, one of
+ *  LOG_PAGES page sized buffers. a full block is sealed and waits
+ *  for flush_flight_data(), called from the idle loops, which hands
+ *  it to the SPI interrupt LOG_FLUSH_CHUNK bytes at a time, so the
+ *  loop does not wait for the flash to program. the block format is
+ *  described in protocol/log_format.h.
+ *
+ *  the flash is a ring of 4 KB sectors, the first block of each
+ *  holds its sequence number. the sector after the one being written
+ *  is always erased (in the background) so the log keeps the most
+ *  recent LOG_SECTORS - 1 sectors. after a reset log_init() finds
+ *  the newest sector from the block headers and carries on in the
+ *  next, so the flights of earlier boots are kept until the ring
+ *  comes round to them. log_list_sessions() prints them.
+ *
+ *  log_trigger() keeps the full rate samples around a crash or a
+ *  panic in capture blocks, whatever the channel settings.
+ *
+ *  jmi
+ *------------------------------------------------------------------
+ */
+
+#include <string.h>
+#include "in4073.h"
+#include "states.h"
+#include "protocol/protocol.h"
+#include "protocol/log_format.h"
+
+#define LOG_SECTORS		(LOG_AREA_SIZE / LOG_SECTOR_SIZE)
+#define LOG_PAGES		2
+#define LOG_FLUSH_CHUNK		32
+#define LOG_RECORD_MAX		((LOG_CHANNEL_VALUES + 1) * LOG_VARINT_MAX + 2)
+
+//blocks in RAM, one being filled and the rest sealed, waiting for flash
+static uint8_t log_pages[LOG_PAGES][LOG_BLOCK_SIZE];
+static uint8_t log_fill;		// page being filled
+static uint8_t log_sealed;		// sealed pages, the oldest is log_fill - log_sealed
+static uint16_t log_flush_offset;	// bytes of the oldest sealed page in flash
+static bool log_flush_capture;		// the block being written is capture_page
+static bool log_flush_done;		// its last chunk has been started
+static volatile bool log_writing;	// a chunk is being programmed in the background
+static volatile bool log_write_failed;
+
+//last values of each channel in the block being filled, records are coded as the difference
+static int32_t log_prev[LOG_CHANNEL_VALUES];
+static uint32_t log_prev_time;
+
+//a channel is logged every log_decimation[] control loop runs, 0 is off
+static uint8_t log_decimation[LOG_CHANNELS] = {1, 0, 1, 0, 0, 1, 1, 0};
+static uint8_t log_countdown[LOG_CHANNELS];
+static const char *const log_channel_names[LOG_CHANNELS] = LOG_CHANNEL_NAMES;
+
+//capture of the samples around a trigger, see log_trigger()
+#define CAPTURE_SAMPLES		24
+#define CAPTURE_PRE_US		160000
+#define CAPTURE_POST_US		80000
+#define CAPTURE_POST_MAX	(CAPTURE_SAMPLES / 3)	// samples, if the loop runs faster than expected
+#define CAPTURE_MASK		(1 << LOG_CH_GYRO | 1 << LOG_CH_ACCEL | 1 << LOG_CH_ATTITUDE | 1 << LOG_CH_MOTORS)
+#define CAPTURE_VALUES		13	// the fields of the channels in CAPTURE_MASK
+#define CAPTURE_TILT_LIMIT	8192	// 45 degrees in phi and theta units
+
+#define CAPTURE_ARMED		0
+#define CAPTURE_POST		1	// triggered, still recording
+#define CAPTURE_FROZEN		2	// being coded into capture blocks
+
+typedef struct {
+	uint32_t time;
+	int16_t v[CAPTURE_VALUES];
+	uint8_t mode;
+} capture_sample_t;
+
+static capture_sample_t capture_ring[CAPTURE_SAMPLES];
+static uint8_t capture_head;		// next sample in the ring
+static uint8_t capture_count;
+static uint8_t capture_post;		// samples since the trigger
+static uint8_t capture_state;
+static uint8_t capture_cause;
+static uint32_t capture_trigger_us;
+static bool capture_tilted;
+static uint8_t capture_page[LOG_BLOCK_SIZE];
+static bool capture_sealed;		// capture_page waits for flash
+static int32_t capture_prev[CAPTURE_VALUES];
+static uint32_t capture_prev_time;
+static uint16_t capture_total;
+
+static uint16_t log_sector;	// sector being written
+static uint8_t log_block;	// next block in it
+static uint32_t log_seq;	// its sequence number
+static uint16_t log_flight;	// sequence number the flight started at
+static bool log_erasing;	// the sector ahead is being erased
+static uint16_t dump_flight;	// flight a log dump is limited to, 0 for all
+
+//overflow and error counters, see log_report()
+static uint32_t log_records;
+static uint32_t log_bytes;
+static uint16_t log_dropped;
+static uint16_t log_write_errors;
+static uint16_t log_max_sealed;
+
+static uint32_t sector_address(uint16_t sector)
+{
+	return (uint32_t)sector * LOG_SECTOR_SIZE;
+}
+
+//all sectors but the one erased ahead may hold data
+static uint32_t oldest_seq(void)
+{
+	return log_seq > LOG_SECTORS - 2 ? log_seq - (LOG_SECTORS - 2) : 1;
+}
+
+static uint16_t seq_sector(uint32_t seq)
+{
+	return (log_sector + LOG_SECTORS - (log_seq - seq)) % LOG_SECTORS;
+}
+
+static bool block_header_ok(const uint8_t *h)
+{
+	return h[0] == LOG_MAGIC_0 && h[1] == LOG_MAGIC_1 && h[LOG_OFS_VERSION] == LOG_VERSION &&
+		h[LOG_OFS_LENGTH] <= LOG_BLOCK_PAYLOAD;
+}
+
+/*------------------------------------------------------------------
+ * reads the header of a block, returns false if there is no block.
+ * only the header is read, scans that skip from block to block would
+ * spend most of their time fetching whole pages into the read cache
+ *------------------------------------------------------------------
+ */
+static bool read_block_header(uint32_t address, uint8_t *h)
+{
+	if (!flash_read_bytes(address, h, LOG_BLOCK_HEADER_SIZE))
+	{
+		return false;
+	}
+	return block_header_ok(h);
+}
+
+/*------------------------------------------------------------------
+ * reads the header of the first block of a sector, returns its
+ * sequence number or 0 if the sector holds no log data
+ *------------------------------------------------------------------
+ */
+static uint32_t read_sector_seq(uint16_t sector)
+{
+	uint8_t h[LOG_BLOCK_HEADER_SIZE];
+	uint32_t seq;
+
+	if (!read_block_header(sector_address(sector), h))
+	{
+		return 0;
+	}
+	seq = get_be32(&h[LOG_OFS_SEQ]);
+	return seq == 0xFFFFFFFF ? 0 : seq;
+}
+
+/*------------------------------------------------------------------
+ * true if the sector reads all 0xFF and needs no erase
+ *------------------------------------------------------------------
+ */
+static bool sector_blank(uint16_t sector)
+{
+	const uint8_t *b;
+	uint32_t address;
+	int i;
+
+	for (address = sector_address(sector); address < sector_address(sector + 1); address += LOG_BLOCK_SIZE)
+	{
+		b = flash_read_page(address);
+		if (b == 0)
+		{
+			return false;
+		}
+		for (i = 0; i < LOG_BLOCK_SIZE; i++)
+		{
+			if (b[i] != 0xFF)
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/*------------------------------------------------------------------
+ * moves the write position to the start of the next sector, which
+ * must be erased already, and starts erasing the one after it. that
+ * is the oldest sector once the ring is full.
+ *------------------------------------------------------------------
+ */
+static void next_sector(void)
+{
+	log_sector = (log_sector + 1) % LOG_SECTORS;
+	log_seq++;
+	log_block = 0;
+	if (flash_sector_erase_start(sector_address((log_sector + 1) % LOG_SECTORS)))
+	{
+		log_erasing = true;
+	}
+	else
+	{
+		log_write_errors++;
+	}
+}
+
+/*------------------------------------------------------------------
+ * picks up after the newest sector in flash, recovered from the
+ * block headers. the new flight always starts on a fresh sector.
+ *------------------------------------------------------------------
+ */
+void log_init(void)
+{
+	uint32_t seq, newest = 0;
+	uint16_t sector, newest_sector = LOG_SECTORS - 1;
+
+	log_fill = 0;
+	log_sealed = 0;
+	log_flush_offset = 0;
+	log_flush_capture = false;
+	log_flush_done = false;
+	capture_state = CAPTURE_ARMED;
+	capture_count = 0;
+	capture_sealed = false;
+	log_pages[0][LOG_OFS_COUNT] = 0;
+	log_pages[0][LOG_OFS_LENGTH] = 0;
+	log_records = 0;
+	log_bytes = 0;
+	log_dropped = 0;
+	log_write_errors = 0;
+	log_max_sealed = 0;
+
+	for (sector = 0; sector < LOG_SECTORS; sector++)
+	{
+		seq = read_sector_seq(sector);
+		if (seq > newest)
+		{
+			newest = seq;
+			newest_sector = sector;
+		}
+	}
+
+	//the next sector is normally erased already, but not after a
+	//reset in the middle of its erase
+	log_sector = newest_sector;
+	log_seq = newest;
+	if (!sector_blank((log_sector + 1) % LOG_SECTORS) &&
+		!flash_sector_erase(sector_address((log_sector + 1) % LOG_SECTORS)))
+	{
+		log_write_errors++;
+	}
+	next_sector();
+	log_flight = log_seq;
+	dump_flight = 0;
+
+	printf("LOG: sector %u, seq %lu\n", log_sector, log_seq);
+}
+
+/*------------------------------------------------------------------
+ * fills in the header of the page being filled and hands it to the
+ * flush side. the sequence number and crc follow once it is known
+ * which sector the block goes to.
+ *------------------------------------------------------------------
+ */
+static void fill_header(uint8_t *b, uint8_t schema)
+{
+	b[0] = LOG_MAGIC_0;
+	b[1] = LOG_MAGIC_1;
+	b[LOG_OFS_VERSION] = LOG_VERSION;
+	b[LOG_OFS_SCHEMA] = schema;
+	b[LOG_OFS_FLIGHT] = log_flight >> 8;
+	b[LOG_OFS_FLIGHT+1] = log_flight & 0xFF;
+}
+
+static void seal_block(void)
+{
+	fill_header(log_pages[log_fill], LOG_SCHEMA_CHANNELS);
+
+	log_sealed++;
+	if (log_sealed > log_max_sealed)
+	{
+		log_max_sealed = log_sealed;
+	}
+	log_fill = (log_fill + 1) % LOG_PAGES;
+	log_pages[log_fill][LOG_OFS_COUNT] = 0;
+	log_pages[log_fill][LOG_OFS_LENGTH] = 0;
+}
+
+/*------------------------------------------------------------------
+ * codes a record of mode and the channels in mask against prev, the last
+ * values in the block, and prev_time. only the values of those
+ * channels are read from v and prev.
+ *------------------------------------------------------------------
+ */
+static int encode_record(uint8_t *p, bool first, uint32_t time, uint8_t mask, uint8_t mode, const int32_t *v, const int32_t *prev, uint32_t prev_time)
+{
+	int ch, i, k, n;
+
+	n = varint_put(p, first ? 0 : time - prev_time);
+	p[n++] = mask;
+	p[n++] = mode;
+	for (ch = 0, k = 0; ch < LOG_CHANNELS; ch++)
+	{
+		for (i = 0; i < log_channel_fields(ch); i++, k++)
+		{
+			if (mask & (1 << ch))
+			{
+				n += varint_put(&p[n], zigzag_encode(first ? v[k] : v[k] - prev[k]));
+			}
+		}
+	}
+	return n;
+}
+
+//appends a coded record to block b and makes it the new prev
+static void append_record(uint8_t *b, const uint8_t *rec, int n, uint8_t mask, const int32_t *v, int32_t *prev)
+{
+	int ch, i, k;
+
+	memcpy(&b[LOG_BLOCK_HEADER_SIZE + b[LOG_OFS_LENGTH]], rec, n);
+	b[LOG_OFS_LENGTH] += n;
+	b[LOG_OFS_COUNT]++;
+	for (ch = 0, k = 0; ch < LOG_CHANNELS; ch++)
+	{
+		for (i = 0; i < log_channel_fields(ch); i++, k++)
+		{
+			if (mask & (1 << ch))
+			{
+				prev[k] = v[k];
+			}
+		}
+	}
+}
+
+/*------------------------------------------------------------------
+ * the channels due in this control loop run
+ *------------------------------------------------------------------
+ */
+static uint8_t due_channels(void)
+{
+	uint8_t mask = 0;
+	int ch;
+
+	for (ch = 0; ch < LOG_CHANNELS; ch++)
+	{
+		if (log_decimation[ch] == 0)
+		{
+			continue;
+		}
+		if (log_countdown[ch] <= 1)
+		{
+			log_countdown[ch] = log_decimation[ch];
+			mask |= 1 << ch;
+		}
+		else
+		{
+			log_countdown[ch]--;
+		}
+	}
+	return mask;
+}
+
+/*------------------------------------------------------------------
+ * capture: every sensor sample, in every state, goes into a small
+ * ring in RAM through log_capture(), whatever the channel settings.
+ * after a trigger the ring records for another CAPTURE_POST_US and
+ * then freezes, by time from the idle loops if no sample comes.
+ * idle time codes the samples from CAPTURE_PRE_US before the
+ * trigger on into capture blocks, which go to flash ahead of the
+ * normal log. after that the ring is armed again; triggers in
+ * between are ignored.
+ *------------------------------------------------------------------
+ */
+void log_trigger(uint8_t cause)
+{
+	if (capture_state != CAPTURE_ARMED)
+	{
+		return;
+	}
+	capture_state = CAPTURE_POST;
+	capture_cause = cause;
+	capture_trigger_us = get_time_us();
+	capture_post = 0;
+}
+
+static void capture_freeze(void)
+{
+	//the oldest sample first, leaving out what is too old
+	capture_state = CAPTURE_FROZEN;
+	capture_head = (capture_head + CAPTURE_SAMPLES - capture_count) % CAPTURE_SAMPLES;
+	while (capture_count > 0 && (int32_t)(capture_trigger_us - capture_ring[capture_head].time) > CAPTURE_PRE_US)
+	{
+		capture_head = (capture_head + 1) % CAPTURE_SAMPLES;
+		capture_count--;
+	}
+	capture_page[LOG_OFS_COUNT] = 0;
+	capture_page[LOG_OFS_LENGTH] = 0;
+	capture_total++;
+}
+
+static void capture_sample(uint32_t time, const int32_t *v)
+{
+	capture_sample_t *c;
+	bool tilted;
+	int i;
+
+	if (capture_state == CAPTURE_FROZEN)
+	{
+		return;
+	}
+
+	c = &capture_ring[capture_head];
+	c->time = time;
+	c->mode = cur_mode;
+	for (i = 0; i < CAPTURE_VALUES; i++)
+	{
+		c->v[i] = v[i];
+	}
+	capture_head = (capture_head + 1) % CAPTURE_SAMPLES;
+	if (capture_count < CAPTURE_SAMPLES)
+	{
+		capture_count++;
+	}
+
+	//only on the way over the limit, not for as long as it lasts
+	tilted = phi > CAPTURE_TILT_LIMIT || phi < -CAPTURE_TILT_LIMIT ||
+		theta > CAPTURE_TILT_LIMIT || theta < -CAPTURE_TILT_LIMIT;
+	if (tilted && !capture_tilted)
+	{
+		log_trigger(LOG_TRIGGER_ATTITUDE);
+	}
+	capture_tilted = tilted;
+
+	if (capture_state == CAPTURE_POST &&
+		(time - capture_trigger_us >= CAPTURE_POST_US || ++capture_post == CAPTURE_POST_MAX))
+	{
+		capture_freeze();
+	}
+}
+
+/* called on each sensor sample that is read, in every state */
+void log_capture(void)
+{
+	int32_t v[CAPTURE_VALUES] = {sp, sq, sr, sax, say, saz, phi, theta, psi,
+		ae[0], ae[1], ae[2], ae[3]};
+
+	capture_sample(get_time_us(), v);
+}
+
+/*------------------------------------------------------------------
+ * codes one frozen sample into capture_page, sealing it when it is
+ * full or the capture is done
+ *------------------------------------------------------------------
+ */
+static void capture_encode(void)
+{
+	uint8_t rec[LOG_RECORD_MAX];
+	int32_t v[CAPTURE_VALUES];
+	capture_sample_t *c = &capture_ring[capture_head];
+	uint8_t *b = capture_page;
+	int i, n;
+
+	if (capture_state != CAPTURE_FROZEN || capture_sealed)
+	{
+		return;
+	}
+	if (capture_count == 0)
+	{
+		if (b[LOG_OFS_COUNT] > 0)
+		{
+			fill_header(b, LOG_SCHEMA_CAPTURE | capture_cause);
+			capture_sealed = true;
+			return;
+		}
+		capture_state = CAPTURE_ARMED;
+		return;
+	}
+
+	for (i = 0; i < CAPTURE_VALUES; i++)
+	{
+		v[i] = c->v[i];
+	}
+	n = encode_record(rec, b[LOG_OFS_COUNT] == 0, c->time, CAPTURE_MASK, c->mode, v, capture_prev, capture_prev_time);
+	if (b[LOG_OFS_LENGTH] + n > LOG_BLOCK_PAYLOAD)
+	{
+		fill_header(b, LOG_SCHEMA_CAPTURE | capture_cause);
+		capture_sealed = true;
+		return;
+	}
+	if (b[LOG_OFS_COUNT] == 0)
+	{
+		put_be32(&b[LOG_OFS_TIME], c->time);
+		memset(capture_prev, 0, sizeof(capture_prev));
+	}
+	append_record(b, rec, n, CAPTURE_MASK, v, capture_prev);
+	capture_prev_time = c->time;
+
+	capture_head = (capture_head + 1) % CAPTURE_SAMPLES;
+	capture_count--;
+}
 
-bool erase_flight_data();
-bool write_flight_data();
-bool read_flight_data();
-//the variable to be updated with get_time_us();
-uint32_t time;
-uint32_t N_BYTES = 24;
 /*------------------------------------------------------------------
- * logs the flight data 
- * write timestamp,mode,batteryvoltage,barometer, gyroscope and
- * accelerometer, connection lost?,  data to flash
+ * stages one record with the channels that are due, see
+ * log_set_channel(). never touches the flash, when no page is free
+ * the record is dropped and counted.
  * jmi
  *------------------------------------------------------------------
  */
-bool write_flight_data(){
-	//time = get_time_us();
-	//adress between 0 and 131071
-	static uint32_t address = 0;
-	uint8_t data[nBytes];
-	//time = uint32_t 
-	data[0] = (time>>24) & 0xFF; 
-	data[1] = (time>>16) & 0xFF; 
-	data[2] = (time>>8) & 0xFF; 
-	data[3] = time & 0xff;	
-	//one byte for mode	
-	data[4] = cur_mode;
-	//bat_volt = uint16_t
-	data[5] = (bat_volt>>8) & 0xFF;
-	data[6] = bat_volt & 0xFF;
-	//pressure = uint32_t
-	data[7] = (pressure>>24) & 0xFF; 
-	data[8] = (pressure>>16) & 0xFF; 
-	data[9] = (pressure>>8) & 0xFF; 
-	data[10] = pressure & 0xff;	
-	
-	//uint16_t sp,sq,sr => gyro p,q,r rate
-	data[11] = (sp>>8) & 0xFF;
-	data[12] = sp & 0xFF;
-	data[13] = (sq>>8) & 0xFF;
-	data[14] = sq & 0xFF;
-	data[15] = (sr>>8) & 0xFF;
-	data[16] = sr & 0xFF;
-	
-	//uint16_t phi,theta,psi =>  	
-	data[17] = (phi>>8) & 0xFF;
-	data[18] = phi & 0xFF;
-	data[19] = (theta>>8) & 0xFF;
-	data[20] = theta & 0xFF;
-	data[21] = (psi>>8) & 0xFF;
-	data[22] = psi & 0xFF;
-	data[23] = 170;
-
-	printf("writing debug flight data\n");	
-
-	if(flash_write_bytes(address, data, nBytes)){
-		address = address + nBytes; 		
-		if((address + nBytes) >= MAX_FLASH_ADDRESS){
-			erase_flight_data();
-			address = 0;				
+bool write_flight_data(void)
+{
+	uint8_t rec[LOG_RECORD_MAX];
+	uint8_t *b = log_pages[log_fill];
+	uint8_t mask = due_channels();
+	uint32_t time = get_time_us();
+	int32_t v[LOG_CHANNEL_VALUES] = {sp, sq, sr, sax, say, saz, phi, theta, psi,
+		ae[0], ae[1], ae[2], ae[3], lift_force, roll_moment, pitch_moment, yaw_moment, p_ctrl,
+		pressure, temperature, bat_volt, frames_rx, checksum_errors, rx_queue.overruns, tx_queue.overruns};
+	int n;
+
+	if (mask == 0)
+	{
+		return true;
+	}
+
+	n = encode_record(rec, b[LOG_OFS_COUNT] == 0, time, mask, cur_mode, v, log_prev, log_prev_time);
+	if (b[LOG_OFS_LENGTH] + n > LOG_BLOCK_PAYLOAD)
+	{
+		if (log_sealed == LOG_PAGES - 1)
+		{
+			log_dropped++;
+			return false;
 		}
-	} else {
-		printf("error writing to spi\n");
+		seal_block();
+		b = log_pages[log_fill];
+		n = encode_record(rec, true, time, mask, cur_mode, v, log_prev, log_prev_time);
+	}
+
+	if (b[LOG_OFS_COUNT] == 0)
+	{
+		put_be32(&b[LOG_OFS_TIME], time);
+		memset(log_prev, 0, sizeof(log_prev));
+	}
+	append_record(b, rec, n, mask, v, log_prev);
+	log_prev_time = time;
+
+	log_records++;
+	log_bytes += n;
+	return true;
+}
+
+/*------------------------------------------------------------------
+ * argument: channel << 8 | decimation, see CMD_LOG_CHANNEL. takes
+ * effect with the next record, which states its channels itself.
+ *------------------------------------------------------------------
+ */
+void log_set_channel(uint32_t argument)
+{
+	uint8_t ch = (argument >> 8) & 0xFF;
+
+	if (ch >= LOG_CHANNELS)
+	{
+		printf("LOG: no channel %u\n", ch);
+		return;
+	}
+	log_decimation[ch] = argument & 0xFF;
+	log_countdown[ch] = 0;
+	if (log_decimation[ch] == 0)
+	{
+		printf("LOG: %s off\n", log_channel_names[ch]);
+	}
+	else
+	{
+		printf("LOG: %s every %u\n", log_channel_names[ch], log_decimation[ch]);
+	}
+}
+
+/* called from the SPI interrupt once a chunk is in flash */
+static void log_chunk_written(bool ok)
+{
+	if (!ok)
+	{
+		log_write_failed = true;
+	}
+	log_writing = false;
+}
+
+/*------------------------------------------------------------------
+ * starts writing up to LOG_FLUSH_CHUNK bytes of the oldest sealed
+ * block to flash, they are programmed from the SPI interrupt. a
+ * page is only handed back once its last chunk is in flash. returns
+ * the number of bytes started.
+ *------------------------------------------------------------------
+ */
+static uint16_t log_flush_chunk(void)
+{
+	uint8_t *b;
+	uint16_t crc, n, size;
+
+	if (log_writing)
+	{
+		return 0;
+	}
+	if (log_write_failed)
+	{
+		log_write_failed = false;
+		log_write_errors++;
+	}
+	if (log_flush_done)
+	{
+		log_flush_done = false;
+		log_flush_offset = 0;
+		log_block++;
+		if (log_flush_capture)
+		{
+			capture_page[LOG_OFS_COUNT] = 0;
+			capture_page[LOG_OFS_LENGTH] = 0;
+			capture_sealed = false;
+		}
+		else
+		{
+			log_sealed--;
+		}
+	}
+
+	//nothing can be written while the sector ahead is erasing
+	if (log_erasing)
+	{
+		if (flash_busy())
+		{
+			return 0;
+		}
+		log_erasing = false;
+	}
+	//a capture block goes first, once the block being written is done
+	if (log_flush_offset == 0)
+	{
+		log_flush_capture = capture_sealed;
+	}
+	if (log_sealed == 0 && !log_flush_capture)
+	{
+		return 0;
+	}
+	if (log_block == LOG_SECTOR_BLOCKS)
+	{
+		next_sector();
 		return 0;
-	} 
-	printf("succesfull write\n");
-	return 1;
-} 
+	}
+
+	b = log_flush_capture ? capture_page : log_pages[(log_fill + LOG_PAGES - log_sealed) % LOG_PAGES];
+	size = LOG_BLOCK_HEADER_SIZE + b[LOG_OFS_LENGTH];
+	if (log_flush_offset == 0)
+	{
+		put_be32(&b[LOG_OFS_SEQ], log_seq);
+		crc = log_block_crc(b);
+		b[LOG_OFS_CRC] = crc >> 8;
+		b[LOG_OFS_CRC+1] = crc & 0xFF;
+	}
+
+	n = size - log_flush_offset;
+	if (n > LOG_FLUSH_CHUNK)
+	{
+		n = LOG_FLUSH_CHUNK;
+	}
+
+	//a failed chunk is skipped rather than retried, rewriting
+	//bytes that did get programmed would corrupt them
+	log_writing = true;
+	if (!flash_write_start(sector_address(log_sector) + log_block * LOG_BLOCK_SIZE + log_flush_offset, &b[log_flush_offset], n, log_chunk_written))
+	{
+		log_writing = false;
+		log_write_errors++;
+	}
+	log_flush_offset += n;
+	if (log_flush_offset == size)
+	{
+		log_flush_done = true;
+	}
+	return n;
+}
+
+/*------------------------------------------------------------------
+ * idle time work, call as often as possible from the wait loops.
+ *------------------------------------------------------------------
+ */
+void flush_flight_data(void)
+{
+	//the window after a trigger ends even if no sample comes in
+	if (capture_state == CAPTURE_POST && get_time_us() - capture_trigger_us >= CAPTURE_POST_US)
+	{
+		capture_freeze();
+	}
+	capture_encode();
+	log_flush_chunk();
+}
+
+/*------------------------------------------------------------------
+ * writes out everything that is staged, including the block that is
+ * only partly filled, before reading the log back
+ *------------------------------------------------------------------
+ */
+void sync_flight_data(void)
+{
+	if (log_pages[log_fill][LOG_OFS_COUNT] > 0)
+	{
+		while (log_sealed == LOG_PAGES - 1)
+		{
+			log_flush_chunk();
+		}
+		seal_block();
+	}
+	while (log_sealed > 0 || log_erasing || log_writing || log_flush_done || capture_state == CAPTURE_FROZEN)
+	{
+		capture_encode();
+		log_flush_chunk();
+	}
+}
+
+void log_report(void)
+{
+	int ch;
+
+	printf("LOG: channels");
+	for (ch = 0; ch < LOG_CHANNELS; ch++)
+	{
+		if (log_decimation[ch] != 0)
+		{
+			printf(" %s/%u", log_channel_names[ch], log_decimation[ch]);
+		}
+	}
+	printf(", %u captures\n", capture_total);
+	printf("LOG: %lu records in %lu B, %u dropped, %u write errors, max %u/%u blocks waiting, seq %lu.%u\n",
+		log_records, log_bytes, log_dropped, log_write_errors, log_max_sealed, LOG_PAGES - 1, log_seq, log_block);
+}
+
+/*------------------------------------------------------------------
+ * session directory. every boot starts a flight on a fresh sector
+ * and each block header carries the flight id (the sequence number
+ * of that sector), so the directory is read back from the headers
+ * instead of being kept in a table of its own that would need an
+ * erase on every boot. older flights stay until the ring needs
+ * their sectors.
+ *------------------------------------------------------------------
+ */
+typedef struct {
+	uint16_t flight;
+	uint16_t sector;	// first sector
+	uint16_t blocks;
+	uint32_t records;
+	uint32_t bytes;
+	uint32_t start_us;	// time of the first and the last block
+	uint32_t last_us;
+} log_session_t;
+
+/*------------------------------------------------------------------
+ * collects the flight starting at sequence number *seq and moves
+ * *seq past it. returns false when there are no more flights.
+ *------------------------------------------------------------------
+ */
+static bool next_session(uint32_t *seq, log_session_t *s)
+{
+	uint8_t h[LOG_BLOCK_HEADER_SIZE];
+	uint16_t sector, flight;
+	uint8_t block;
+
+	s->blocks = 0;
+	for (; *seq <= log_seq; (*seq)++)
+	{
+		sector = seq_sector(*seq);
+		if (read_sector_seq(sector) != *seq)
+		{
+			continue;
+		}
+		for (block = 0; block < LOG_SECTOR_BLOCKS; block++)
+		{
+			if (!read_block_header(sector_address(sector) + block * LOG_BLOCK_SIZE, h))
+			{
+				break;
+			}
+			flight = (h[LOG_OFS_FLIGHT] << 8) | h[LOG_OFS_FLIGHT+1];
+			if (s->blocks == 0)
+			{
+				s->flight = flight;
+				s->sector = sector;
+				s->records = 0;
+				s->bytes = 0;
+				s->start_us = get_be32(&h[LOG_OFS_TIME]);
+			}
+			else if (flight != s->flight)
+			{
+				return true;
+			}
+			s->blocks++;
+			s->records += h[LOG_OFS_COUNT];
+			s->bytes += LOG_BLOCK_HEADER_SIZE + h[LOG_OFS_LENGTH];
+			s->last_us = get_be32(&h[LOG_OFS_TIME]);
+		}
+	}
+	return s->blocks > 0;
+}
+
+/*------------------------------------------------------------------
+ * prints the flights in flash, oldest first, the one a log dump is
+ * limited to marked with a *
+ *------------------------------------------------------------------
+ */
+void log_list_sessions(void)
+{
+	log_session_t s;
+	uint32_t seq = oldest_seq();
+
+	sync_flight_data();
+	printf("LOG: flights in flash, this boot is %u\n", log_flight);
+	while (next_session(&seq, &s))
+	{
+		printf("LOG: %cflight %u, sector %u, %u blocks, %lu records in %lu B, start %lu us, %lu ms\n",
+			s.flight == dump_flight ? '*' : ' ', s.flight, s.sector, s.blocks, s.records, s.bytes,
+			s.start_us, (s.last_us - s.start_us) / 1000);
+		nrf_delay_ms(15);
+	}
+}
+
+/*------------------------------------------------------------------
+ * limits log dumps to the next older flight, wrapping round to all
+ * of the log after the oldest one
+ *------------------------------------------------------------------
+ */
+void log_select_session(void)
+{
+	log_session_t s;
+	uint32_t seq = oldest_seq();
+	uint16_t older = 0;
+
+	sync_flight_data();
+	while (next_session(&seq, &s))
+	{
+		if (dump_flight != 0 && s.flight == dump_flight)
+		{
+			break;
+		}
+		older = s.flight;
+	}
+	//with all of the log selected, or the flight overwritten, the
+	//newest one is next
+	dump_flight = older;
+	if (dump_flight == 0)
+	{
+		printf("LOG: dump selects all flights\n");
+	}
+	else
+	{
+		printf("LOG: dump selects flight %u\n", dump_flight);
+	}
+}
+
+/*------------------------------------------------------------------
+ * binary log dump, see DUMP_HEADER in protocol/protocol.h
+ *
+ * the flash is sent as is, block by block, leaving out pages without
+ * a block and the unused end of each block. the terminal acks every
+ * few frames and no more than LOG_DUMP_WINDOW frames are sent ahead
+ * of the last ack. after a lost frame the terminal restarts the dump
+ * at the address it has everything up to. log_select_session()
+ * limits the dump to the blocks of one flight.
+ *------------------------------------------------------------------
+ */
+#define LOG_DUMP_WINDOW		16
+#define LOG_DUMP_SCAN		16	// empty pages skipped per poll
+
+static bool dump_active;
+static uint32_t dump_address;
+static uint32_t dump_page;	// page the block end below belongs to
+static uint32_t dump_block_end;
+static uint8_t dump_seq;
+static uint32_t dump_sent;
+static uint32_t dump_acked;
+
+void log_dump_start(uint32_t argument)
+{
+	sync_flight_data();
+	dump_active = true;
+	dump_address = argument & DUMP_END_ADDRESS;
+	dump_page = 0xFFFFFFFF;
+	dump_seq = argument >> 21;
+	dump_sent = 0;
+	dump_acked = 0;
+}
+
+void log_dump_ack(uint32_t frames)
+{
+	// an ack from before a restart can count more than was sent since
+	if (frames <= dump_sent)
+	{
+		dump_acked = frames;
+	}
+}
+
+static void send_dump_frame(uint32_t address, const uint8_t *data)
+{
+	uint8_t f[DUMP_SIZE];
+	int i;
+
+	f[0] = DUMP_HEADER;
+	f[1] = dump_seq;
+	put_septets(&f[2], address, 3);
+	pack_septets(&f[5], data, DUMP_DATA);
+	put_septets(&f[DUMP_OFS_CRC], dump_frame_crc(f), 2);
+	f[DUMP_SIZE-1] = frame_checksum(f, DUMP_SIZE);
+
+	for (i = 0; i < DUMP_SIZE; i++)
+	{
+		uart_put(f[i]);
+	}
+	dump_seq = (dump_seq + 1) & 0x7F;
+	dump_sent++;
+}
+
+/*------------------------------------------------------------------
+ * idle time work like flush_flight_data(), sends as many frames as
+ * the window and the uart tx queue allow
+ *------------------------------------------------------------------
+ */
+void log_dump_poll(void)
+{
+	uint8_t data[DUMP_DATA], h[LOG_BLOCK_HEADER_SIZE];
+	uint32_t n;
+	int scan = 0;
+
+	//reads return garbage while the sector ahead is being erased
+	while (dump_active && !log_erasing && dump_sent - dump_acked < LOG_DUMP_WINDOW &&
+		QUEUE_SIZE - tx_queue.count >= DUMP_SIZE)
+	{
+		//find the next stretch of block data
+		while (dump_address < LOG_AREA_SIZE)
+		{
+			if ((dump_address & ~(LOG_BLOCK_SIZE - 1)) != dump_page)
+			{
+				if (scan++ == LOG_DUMP_SCAN)
+				{
+					return;
+				}
+				dump_page = dump_address & ~(LOG_BLOCK_SIZE - 1);
+				dump_block_end = dump_page;
+				if (read_block_header(dump_page, h) && (dump_flight == 0 ||
+					((h[LOG_OFS_FLIGHT] << 8) | h[LOG_OFS_FLIGHT+1]) == dump_flight))
+				{
+					dump_block_end = dump_page + LOG_BLOCK_HEADER_SIZE + h[LOG_OFS_LENGTH];
+				}
+			}
+			if (dump_address < dump_block_end)
+			{
+				break;
+			}
+			dump_address = dump_page + LOG_BLOCK_SIZE;
+		}
+
+		memset(data, 0xFF, DUMP_DATA);
+		if (dump_address >= LOG_AREA_SIZE)
+		{
+			send_dump_frame(DUMP_END_ADDRESS, data);
+			dump_active = false;
+			break;
+		}
+
+		n = dump_block_end - dump_address;
+		if (n > DUMP_DATA)
+		{
+			n = DUMP_DATA;
+		}
+		flash_read_cached(dump_address, data, n);
+		send_dump_frame(dump_address, data);
+		dump_address += n;
+	}
+}
+
+/*------------------------------------------------------------------
+ * prints the records of one block as csv, returns false if there is
+ * no block at address. a block is one flash page, the records are
+ * decoded straight from the read cache.
+ *------------------------------------------------------------------
+ */
+static bool print_block(uint32_t address)
+{
+	const uint8_t *b;
+	int32_t v[LOG_CHANNEL_VALUES];
+	uint32_t time;
+	uint8_t mask, mode;
+	int ch, i, k, n, pos;
+
+	b = flash_read_page(address);
+	if (b == 0 || !block_header_ok(b))
+	{
+		return false;
+	}
+	if (log_block_crc(b) != ((b[LOG_OFS_CRC] << 8) | b[LOG_OFS_CRC+1]))
+	{
+		printf("crc error in block at %lu\n", address);
+		return true;
+	}
+
+	if (b[LOG_OFS_SCHEMA] != LOG_SCHEMA_CHANNELS && (b[LOG_OFS_SCHEMA] & LOG_SCHEMA_CAPTURE) == 0)
+	{
+		printf("block at %lu has schema %u, decode it with logdecode\n", address, b[LOG_OFS_SCHEMA]);
+		return true;
+	}
+
+	time = get_be32(&b[LOG_OFS_TIME]);
+	memset(v, 0, sizeof(v));
+	pos = LOG_BLOCK_HEADER_SIZE;
+	for (i = 0; i < b[LOG_OFS_COUNT]; i++)
+	{
+		n = log_decode_channels(&b[pos], LOG_BLOCK_HEADER_SIZE + b[LOG_OFS_LENGTH] - pos, &time, &mask, &mode, v);
+		if (n == 0)
+		{
+			printf("bad record in block at %lu\n", address);
+			return true;
+		}
+		pos += n;
+
+		//absent channels are left empty. a channel at a time, so the
+		//uart tx queue can drain in between
+		printf("%u,%lu,%u", (b[LOG_OFS_FLIGHT] << 8) | b[LOG_OFS_FLIGHT+1], time, mode);
+		for (ch = 0, k = 0; ch < LOG_CHANNELS; ch++)
+		{
+			for (n = 0; n < log_channel_fields(ch); n++, k++)
+			{
+				if (mask & (1 << ch))
+				{
+					printf(",%ld", v[k]);
+				}
+				else
+				{
+					printf(",");
+				}
+			}
+			if (mask & (1 << ch))
+			{
+				nrf_delay_ms(6);
+			}
+		}
+		if (b[LOG_OFS_SCHEMA] & LOG_SCHEMA_CAPTURE)
+		{
+			printf(",%u\n", b[LOG_OFS_SCHEMA] & ~LOG_SCHEMA_CAPTURE);
+		}
+		else
+		{
+			printf(",\n");
+		}
+	}
+	return true;
+}
 
 /*------------------------------------------------------------------
- * reads the flight data from memory.
+ * reads the flight data from memory, oldest sector first.
  *------------------------------------------------------------------
  */
 bool read_flight_data(){
-	//adress between 0 and 131071
-	static uint32_t address = 0;
-	
-	uint8_t buffer[nBytes];
-	uint32_t rtime, rpressure;
-	uint8_t rmode;
-    uint8_t static written_check = 170;
-	uint16_t rbat_volt, rsp, rsq, rsr, rphi, rtheta, rpsi; 
-	printf("log of previous flight\n");
-	nrf_delay_ms(15);		
-	printf("address,time_ms,mode,bat_volt,pressure,sp,sq,sr,phi,theta,psi,write_check(=170)\n");
+	const char *header;
+	uint32_t seq;
+	uint16_t sector;
+	uint8_t block;
+	int n;
+
+	sync_flight_data();
+
+	printf("flight log\n");
 	nrf_delay_ms(15);
-	//escape loop if end is reached, or byte 23 does not contain AA
-	//else we need to dump complete flash, which is time consuming.
-	//170 is an arbitrary picked value
-	while(((address + nBytes) < MAX_FLASH_ADDRESS) && (written_check == 170)) {
-		if(flash_read_bytes(address, buffer, nBytes)){
-			rtime = (buffer[0]<<24) + (buffer[1]<<16) + (buffer[2]<<8) + (buffer[3]);
-			rmode = buffer[4];
-			rbat_volt = (buffer[5]<<8) + buffer[6];
-			rpressure = (buffer[7] <<24) + (buffer[8] << 16) + (buffer[8] << 8) + buffer[10];
-	
-			rsp = (buffer[11] << 8) + buffer[12];
-			rsq = (buffer[13] << 8) + buffer[14];	
-			rsr = (buffer[15] << 8) + buffer[16];
-			
-			rphi = (buffer[17] << 8) + buffer[18]; 
-			rtheta = (buffer[19] << 8) + buffer[20];
-			rpsi = (buffer[21] << 8) + buffer[22];
-			written_check = buffer[23];			
-			
-			printf("%ld,%ld,%d,%d,%ld,%d,%d,%d,%d,%d,%d,%d\n",address, rtime,rmode,rbat_volt,rpressure,rsp,rsq,rsr,rphi,rtheta,rpsi,written_check);		
-			address += nBytes;
-			nrf_delay_ms(15);		
-		}  else {
-			printf("error while reading\n");
-			return 0;
-		}						
-	}	
-	return 0;
-} 
+	for (header = LOG_CSV_HEADER; *header != '\0'; header += n)
+	{
+		n = strlen(header) < 64 ? strlen(header) : 64;
+		printf("%.*s", n, header);
+		nrf_delay_ms(6);
+	}
+
+	for (seq = oldest_seq(); seq <= log_seq; seq++)
+	{
+		sector = seq_sector(seq);
+		if (read_sector_seq(sector) != seq)
+		{
+			continue;
+		}
+		for (block = 0; block < LOG_SECTOR_BLOCKS; block++)
+		{
+			if (!print_block(sector_address(sector) + block * LOG_BLOCK_SIZE))
+			{
+				break;
+			}
+		}
+	}
+	return true;
+}
 
 /*------------------------------------------------------------------
- * erases all the flight data so we can log a new flight
- * call this function after leaving safe mode, so we can 
- * read the previous log in safe mode!	
+ * erases all the flight data and starts the log over in sector 0
  * jmi
  *-----------------------------------------------------------------
  */
-bool erase_flight_data() { 
+bool erase_flight_data() {
+	sync_flight_data();
 	if(flash_chip_erase()){
+		log_init();
 		return true;
 	} else {
 		return false;
@@ -0,0 +1,67 @@
+/*------------------------------------------------------------
+ * frame_decoder.c -- downlink byte stream parser
+ *------------------------------------------------------------
+ */
+
+#include "../protocol/protocol.h"
+#include "frame_decoder.h"
+
+/* length of a downlink frame including header and checksum, 0 if unknown */
+int downlink_frame_size(uint8_t header)
+{
+	switch (header)
+	{
+	case PONG_HEADER:
+		return PONG_SIZE;
+	case DUMP_HEADER:
+		return DUMP_SIZE;
+	case PROFILE_HEADER:
+		return PROFILE_SIZE;
+	default:
+		return 0;
+	}
+}
+
+void frame_decoder_init(frame_decoder_t *d)
+{
+	d->len = 0;
+	d->need = 0;
+	d->frames = 0;
+	d->checksum_errors = 0;
+	d->dropped = 0;
+}
+
+int frame_decoder_feed(frame_decoder_t *d, uint8_t b)
+{
+	if (b & 0x80)
+	{
+		// a header always starts over, even inside a frame
+		if (d->need)
+			d->dropped++;
+		d->need = downlink_frame_size(b);
+		d->len = 0;
+		if (d->need == 0)
+		{
+			d->dropped++;
+			return FRAME_NONE;
+		}
+		d->buf[d->len++] = b;
+		return FRAME_NONE;
+	}
+
+	if (d->need == 0)
+		return FRAME_TEXT;
+
+	d->buf[d->len++] = b;
+	if (d->len < d->need)
+		return FRAME_NONE;
+
+	d->need = 0;
+	if (d->buf[d->len - 1] != frame_checksum(d->buf, d->len))
+	{
+		d->checksum_errors++;
+		return FRAME_NONE;
+	}
+	d->frames++;
+	return FRAME_DONE;
+}
@@ -0,0 +1,31 @@
+#ifndef FRAME_DECODER_H__
+#define FRAME_DECODER_H__
+
+#include <inttypes.h>
+
+/*------------------------------------------------------------
+ * frame_decoder -- splits the drone's output into plain text
+ * and binary frames, see the framing notes in protocol.h
+ *------------------------------------------------------------
+ */
+
+#define FRAME_MAX_SIZE		64
+
+#define FRAME_NONE		0	// byte consumed, nothing to do
+#define FRAME_TEXT		1	// byte is printf text
+#define FRAME_DONE		2	// a checked frame is in buf[0..len-1]
+
+typedef struct {
+	uint8_t  buf[FRAME_MAX_SIZE];
+	int      len;
+	int      need;		// 0 when not inside a frame
+	uint32_t frames;
+	uint32_t checksum_errors;
+	uint32_t dropped;	// headers of unknown frames, truncated frames
+} frame_decoder_t;
+
+int  downlink_frame_size(uint8_t header);
+void frame_decoder_init(frame_decoder_t *d);
+int  frame_decoder_feed(frame_decoder_t *d, uint8_t b);
+
+#endif
@@ -25,6 +25,9 @@ char roll_pitch_offset_p2;
 
 char mode = 0;
 
+// one-shot uplink command (CMD_*), 0 when none is pending
+char command = 0;
+
 int	axis[6];
 int	button[12];
 int fd = 0;
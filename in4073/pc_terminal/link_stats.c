@@ -0,0 +1,114 @@
+/*------------------------------------------------------------
+ * link_stats.c -- ping/pong bookkeeping for the pc terminal
+ *------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../protocol/protocol.h"
+#include "tx_sched.h"
+#include "link_stats.h"
+
+void link_stats_init(link_stats_t *l)
+{
+	memset(l, 0, sizeof(*l));
+	l->report_us = mon_time_us() + LINK_REPORT_PERIOD_US;
+}
+
+/* fills an uplink ping frame (PACKET_SIZE bytes) */
+void make_ping_frame(uint8_t *frame, uint8_t seq, uint64_t now_us)
+{
+	frame[0] = PING_HEADER;
+	frame[1] = seq & 0x7F;
+	put_septets(&frame[2], now_us & PING_TIME_MASK, 4);
+	frame[6] = 0;
+	frame[7] = frame_checksum(frame, PACKET_SIZE);
+}
+
+/* records a ping that went out at sent_us */
+void link_stats_ping_sent(link_stats_t *l, const uint8_t *frame, uint64_t sent_us)
+{
+	ping_slot_t *s = &l->slot[l->next];
+
+	s->sent_us = sent_us;
+	s->rtt_us = -1;
+	s->seq = frame[1];
+	s->used = 1;
+	l->next = (l->next + 1) % LINK_WINDOW;
+}
+
+/* matches a pong received at rx_us against the outstanding pings */
+void link_stats_pong(link_stats_t *l, const uint8_t *frame, uint64_t rx_us)
+{
+	uint8_t seq = frame[1];
+	uint32_t t = get_septets(&frame[2], 4);
+	int i;
+
+	l->pongs++;
+	l->drone_frames_rx = get_septets(&frame[6], 2);
+	l->drone_checksum_errors = get_septets(&frame[8], 2);
+	l->drone_overruns = get_septets(&frame[10], 2);
+	l->drone_cpu_load = get_septets(&frame[12], 2);
+
+	for (i = 0; i < LINK_WINDOW; i++)
+	{
+		ping_slot_t *s = &l->slot[i];
+
+		if (s->used && s->rtt_us < 0 && s->seq == seq && (s->sent_us & PING_TIME_MASK) == t)
+		{
+			s->rtt_us = rx_us - s->sent_us;
+			return;
+		}
+	}
+	l->unmatched++;
+}
+
+static int cmp_i64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+/* formats the link report into buf once per LINK_REPORT_PERIOD_US, returns 0 otherwise */
+int link_stats_report(link_stats_t *l, char *buf, int len)
+{
+	int64_t rtt[LINK_WINDOW];
+	uint64_t now = mon_time_us();
+	int i, n = 0, lost = 0, considered = 0;
+
+	if (now < l->report_us)
+		return 0;
+	l->report_us = now + LINK_REPORT_PERIOD_US;
+
+	for (i = 0; i < LINK_WINDOW; i++)
+	{
+		ping_slot_t *s = &l->slot[i];
+
+		if (!s->used)
+			continue;
+		if (s->rtt_us >= 0)
+		{
+			rtt[n++] = s->rtt_us;
+			considered++;
+		}
+		else if (now - s->sent_us > PING_TIMEOUT_US)
+		{
+			lost++;
+			considered++;
+		}
+	}
+
+	if (n == 0)
+		return snprintf(buf, len, "PC SIDE: link no pongs, loss=%d/%d\n", lost, considered);
+
+	qsort(rtt, n, sizeof(rtt[0]), cmp_i64);
+	return snprintf(buf, len,
+		"PC SIDE: link rtt p50=%.1f p90=%.1f p99=%.1f max=%.1f ms, loss=%.1f%% (%d/%d), "
+		"drone rx=%u chk_err=%u overrun=%u cpu=%.1f%%\n",
+		rtt[(n - 1) * 50 / 100] / 1e3, rtt[(n - 1) * 90 / 100] / 1e3,
+		rtt[(n - 1) * 99 / 100] / 1e3, rtt[n - 1] / 1e3,
+		100.0 * lost / considered, lost, considered,
+		l->drone_frames_rx, l->drone_checksum_errors, l->drone_overruns, l->drone_cpu_load / 10.0);
+}
@@ -0,0 +1,49 @@
+#ifndef LINK_STATS_H__
+#define LINK_STATS_H__
+
+#include <inttypes.h>
+
+/*------------------------------------------------------------
+ * link_stats -- round trip time and loss over the serial link
+ *
+ * the terminal sends a ping with a sequence number and its own
+ * timestamp, the drone reflects it together with its receive
+ * counters. statistics cover the last LINK_WINDOW pings.
+ *------------------------------------------------------------
+ */
+
+#define LINK_WINDOW		100
+#define PING_RATE_HZ		10
+#define PING_TIMEOUT_US		1000000
+#define LINK_REPORT_PERIOD_US	2000000
+
+typedef struct {
+	uint64_t sent_us;
+	int64_t  rtt_us;	// -1 while unanswered
+	uint8_t  seq;
+	uint8_t  used;
+} ping_slot_t;
+
+typedef struct {
+	ping_slot_t slot[LINK_WINDOW];
+	int      next;
+
+	// drone side counters from the latest pong (14 bit, wrapping)
+	uint16_t drone_frames_rx;
+	uint16_t drone_checksum_errors;
+	uint16_t drone_overruns;
+	uint16_t drone_cpu_load;	// per mille awake over the last second
+	uint32_t pongs;
+	uint32_t unmatched;	// pongs that arrived after their slot was reused
+
+	uint64_t report_us;
+} link_stats_t;
+
+void make_ping_frame(uint8_t *frame, uint8_t seq, uint64_t now_us);
+
+void link_stats_init(link_stats_t *l);
+void link_stats_ping_sent(link_stats_t *l, const uint8_t *frame, uint64_t sent_us);
+void link_stats_pong(link_stats_t *l, const uint8_t *frame, uint64_t rx_us);
+int  link_stats_report(link_stats_t *l, char *buf, int len);
+
+#endif
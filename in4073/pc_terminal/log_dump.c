@@ -0,0 +1,127 @@
+/*------------------------------------------------------------
+ * log_dump.c -- reassembles the flight log from DUMP frames
+ *------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "../protocol/protocol.h"
+#include "log_dump.h"
+
+/* the new seq is well clear of any frames still in flight */
+static void restart(log_dump_t *d, uint64_t now_us, uint8_t *reply)
+{
+	d->restarting = 1;
+	d->next_seq = (d->next_seq + 64) & 0x7F;
+	d->last_us = now_us;
+	make_command_frame(reply, CMD_LOG_DUMP, (uint32_t)d->next_seq << 21 | d->resume);
+}
+
+void log_dump_start(log_dump_t *d, const char *path, uint64_t now_us, uint8_t *reply)
+{
+	memset(d->image, 0xFF, sizeof(d->image));
+	d->path = path;
+	d->active = 1;
+	d->resume = 0;
+	d->frames = 0;
+	d->bytes = 0;
+	d->restarts = 0;
+	d->crc_errors = 0;
+	d->next_seq = 0;
+	d->start_us = now_us;
+	restart(d, now_us, reply);
+}
+
+int log_dump_frame(log_dump_t *d, const uint8_t *frame, uint64_t now_us, uint8_t *reply)
+{
+	uint8_t seq = frame[1];
+	uint32_t address = get_septets(&frame[2], 3);
+	uint32_t n = DUMP_DATA;
+	uint8_t data[DUMP_DATA];
+
+	if (!d->active)
+		return 0;
+	d->last_us = now_us;
+
+	// a frame that fails the crc counts as lost
+	if (get_septets(&frame[DUMP_OFS_CRC], 2) != dump_frame_crc(frame))
+	{
+		d->crc_errors++;
+		if (d->restarting)
+			return 0;
+		d->restarts++;
+		restart(d, now_us, reply);
+		return LOG_DUMP_REPLY;
+	}
+
+	// frames still on their way from before a restart are dropped
+	if (d->restarting)
+	{
+		if (seq != d->next_seq)
+			return 0;
+		d->restarting = 0;
+		d->in_order = 0;
+	}
+	if (seq != d->next_seq)
+	{
+		d->restarts++;
+		restart(d, now_us, reply);
+		return LOG_DUMP_REPLY;
+	}
+	d->next_seq = (seq + 1) & 0x7F;
+	d->in_order++;
+	d->frames++;
+
+	if (address == DUMP_END_ADDRESS)
+	{
+		d->active = 0;
+		return LOG_DUMP_DONE;
+	}
+
+	// a frame never crosses a block, the end of one is padded up to a
+	// whole frame and must not cover the start of the next
+	if (address >= LOG_AREA_SIZE)
+		return 0;
+	if (n > LOG_BLOCK_SIZE - address % LOG_BLOCK_SIZE)
+		n = LOG_BLOCK_SIZE - address % LOG_BLOCK_SIZE;
+	unpack_septets(data, &frame[5], DUMP_DATA);
+	memcpy(&d->image[address], data, n);
+	d->bytes += n;
+	d->resume = address + n;
+
+	if (d->in_order % LOG_DUMP_ACK_EVERY == 0)
+	{
+		make_command_frame(reply, CMD_LOG_DUMP_ACK, d->in_order);
+		return LOG_DUMP_REPLY;
+	}
+	return 0;
+}
+
+/* restarts a dump that has gone quiet, a lost ack or end frame stalls it */
+int log_dump_poll(log_dump_t *d, uint64_t now_us, uint8_t *reply)
+{
+	if (!d->active || now_us - d->last_us < LOG_DUMP_TIMEOUT_US)
+		return 0;
+	d->restarts++;
+	restart(d, now_us, reply);
+	return LOG_DUMP_REPLY;
+}
+
+/* saves the image, the summary goes to buf */
+int log_dump_finish(log_dump_t *d, uint64_t now_us, char *buf, int len)
+{
+	FILE *f;
+	double t = (now_us - d->start_us) / 1e6;
+
+	f = fopen(d->path, "wb");
+	if (f == NULL || fwrite(d->image, 1, sizeof(d->image), f) != sizeof(d->image))
+	{
+		if (f)
+			fclose(f);
+		return snprintf(buf, len, "PC SIDE: cannot write log dump to %s\n", d->path);
+	}
+	fclose(f);
+	return snprintf(buf, len, "PC SIDE: log dump of %u bytes in %.1f s (%.0f B/s, %u frames, %u restarts, %u crc errors) "
+		"saved to %s, decode with logdecode\n",
+		d->bytes, t, t > 0 ? d->bytes / t : 0, d->frames, d->restarts, d->crc_errors, d->path);
+}
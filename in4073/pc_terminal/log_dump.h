@@ -0,0 +1,44 @@
+#ifndef LOG_DUMP_H__
+#define LOG_DUMP_H__
+
+#include <inttypes.h>
+#include "../protocol/log_format.h"
+
+/*------------------------------------------------------------
+ * log_dump -- terminal side of the binary flight log dump
+ *
+ * DUMP frames are placed at their flash address in an image
+ * of the log area, which is saved once the end frame arrives.
+ * frames carry a 7 bit sequence number; on a gap, a crc error or a stall
+ * the dump is restarted at the address everything before has
+ * been received up to, with a new first sequence number.
+ * logdecode turns the image into csv.
+ *------------------------------------------------------------
+ */
+
+#define LOG_DUMP_ACK_EVERY	4
+#define LOG_DUMP_TIMEOUT_US	500000
+#define LOG_DUMP_DEFAULT_FILE	"flight_log.bin"
+
+// what the caller has to do after log_dump_frame() and log_dump_poll()
+#define LOG_DUMP_REPLY		1	// send the frame left in reply
+#define LOG_DUMP_DONE		2	// image is complete, call log_dump_finish()
+
+typedef struct {
+	uint8_t  image[LOG_AREA_SIZE];
+	const char *path;
+	int      active;
+	int      restarting;	// waiting for next_seq after a restart
+	uint8_t  next_seq;
+	uint32_t in_order;	// frames received in order since the (re)start
+	uint32_t resume;	// everything below this address is in
+	uint32_t frames, bytes, restarts, crc_errors;
+	uint64_t start_us, last_us;
+} log_dump_t;
+
+void log_dump_start(log_dump_t *d, const char *path, uint64_t now_us, uint8_t *reply);
+int  log_dump_frame(log_dump_t *d, const uint8_t *frame, uint64_t now_us, uint8_t *reply);
+int  log_dump_poll(log_dump_t *d, uint64_t now_us, uint8_t *reply);
+int  log_dump_finish(log_dump_t *d, uint64_t now_us, char *buf, int len);
+
+#endif
@@ -0,0 +1,168 @@
+/*------------------------------------------------------------
+ * logdecode.c -- flight log image to csv
+ *
+ * reads the image of the log area saved by a log dump (key R
+ * in the terminal), checks every block and prints the records
+ * oldest first, in the same columns as read_flight_data() on
+ * the drone. channels a record does not hold are left empty,
+ * blocks of the older fixed schema 1 fill in the channels it
+ * had. records from a capture block have the trigger in the last
+ * column and repeat the time span around it at the full rate.
+ * a summary goes to stderr.
+ *
+ * usage: logdecode image.bin > flight.csv
+ *------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../protocol/log_format.h"
+
+typedef struct {
+	uint32_t seq;
+	uint32_t address;
+} block_ref_t;
+
+static uint8_t image[LOG_AREA_SIZE];
+
+static int by_seq(const void *a, const void *b)
+{
+	const block_ref_t *x = a, *y = b;
+
+	if (x->seq != y->seq)
+		return x->seq < y->seq ? -1 : 1;
+	return x->address < y->address ? -1 : x->address > y->address;
+}
+
+// where the fields of schema 1 go in the channel layout
+static const int flight_schema_index[LOG_SCHEMA_FLIGHT_FIELDS] = {-1, 20, 18, 0, 1, 2, 6, 7, 8};
+
+// one bit per value in v for the channels in mask
+static uint32_t value_mask(uint8_t mask)
+{
+	uint32_t m = 0;
+	int ch, i, k;
+
+	for (ch = 0, k = 0; ch < LOG_CHANNELS; ch++)
+		for (i = 0; i < log_channel_fields(ch); i++, k++)
+			if (mask & (1 << ch))
+				m |= 1u << k;
+	return m;
+}
+
+static void print_record(const uint8_t *b, uint32_t time, uint32_t present, uint8_t mode, const int32_t *v)
+{
+	uint8_t schema = b[LOG_OFS_SCHEMA];
+	int k;
+
+	printf("%u,%u,%u", (b[LOG_OFS_FLIGHT] << 8) | b[LOG_OFS_FLIGHT + 1], time, mode);
+	for (k = 0; k < LOG_CHANNEL_VALUES; k++)
+	{
+		if (present & (1u << k))
+			printf(",%d", v[k]);
+		else
+			printf(",");
+	}
+	// the trigger for records of a capture block
+	if (schema & LOG_SCHEMA_CAPTURE)
+		printf(",%u\n", schema & ~LOG_SCHEMA_CAPTURE);
+	else
+		printf(",\n");
+}
+
+/* returns the number of records, -1 if the block is corrupt */
+static int decode_block(const uint8_t *b)
+{
+	int32_t v[LOG_CHANNEL_VALUES] = {0}, f[LOG_SCHEMA_FLIGHT_FIELDS];
+	uint32_t time = get_be32(&b[LOG_OFS_TIME]);
+	uint32_t present = 0;
+	uint8_t mask, mode;
+	int i, k, n, pos = LOG_BLOCK_HEADER_SIZE;
+	int end = LOG_BLOCK_HEADER_SIZE + b[LOG_OFS_LENGTH];
+
+	for (i = 0; i < b[LOG_OFS_COUNT]; i++)
+	{
+		switch (b[LOG_OFS_SCHEMA] & LOG_SCHEMA_CAPTURE ? LOG_SCHEMA_CHANNELS : b[LOG_OFS_SCHEMA])
+		{
+		case LOG_SCHEMA_FLIGHT:
+			n = log_decode_record(&b[pos], end - pos, LOG_SCHEMA_FLIGHT_FIELDS, i == 0, &time, f);
+			mode = f[0];
+			for (k = 1; k < LOG_SCHEMA_FLIGHT_FIELDS; k++)
+			{
+				v[flight_schema_index[k]] = f[k];
+				present |= 1u << flight_schema_index[k];
+			}
+			break;
+		case LOG_SCHEMA_CHANNELS:
+			n = log_decode_channels(&b[pos], end - pos, &time, &mask, &mode, v);
+			if (n != 0)
+				present = value_mask(mask);
+			break;
+		default:
+			n = 0;
+			break;
+		}
+		if (n == 0)
+			return -1;
+		pos += n;
+		print_record(b, time, present, mode, v);
+	}
+	return i;
+}
+
+int main(int argc, char **argv)
+{
+	static block_ref_t blocks[LOG_AREA_SIZE / LOG_BLOCK_SIZE];
+	FILE *f;
+	const uint8_t *b;
+	uint32_t address;
+	int i, n, count = 0, bad = 0, records = 0;
+
+	if (argc != 2)
+	{
+		fprintf(stderr, "usage: %s image.bin > flight.csv\n", argv[0]);
+		return 1;
+	}
+	f = fopen(argv[1], "rb");
+	if (f == NULL)
+	{
+		perror(argv[1]);
+		return 1;
+	}
+	n = fread(image, 1, sizeof(image), f);
+	fclose(f);
+
+	for (address = 0; address + LOG_BLOCK_SIZE <= (uint32_t) n; address += LOG_BLOCK_SIZE)
+	{
+		b = &image[address];
+		if (b[0] != LOG_MAGIC_0 || b[1] != LOG_MAGIC_1)
+			continue;
+		if (b[LOG_OFS_VERSION] != LOG_VERSION || b[LOG_OFS_LENGTH] > LOG_BLOCK_PAYLOAD ||
+			log_block_crc(b) != ((b[LOG_OFS_CRC] << 8) | b[LOG_OFS_CRC + 1]))
+		{
+			fprintf(stderr, "bad block at 0x%05x\n", address);
+			bad++;
+			continue;
+		}
+		blocks[count].seq = get_be32(&b[LOG_OFS_SEQ]);
+		blocks[count].address = address;
+		count++;
+	}
+	qsort(blocks, count, sizeof(blocks[0]), by_seq);
+
+	printf(LOG_CSV_HEADER);
+	for (i = 0; i < count; i++)
+	{
+		n = decode_block(&image[blocks[i].address]);
+		if (n < 0)
+		{
+			fprintf(stderr, "cannot decode block at 0x%05x\n", blocks[i].address);
+			bad++;
+			continue;
+		}
+		records += n;
+	}
+
+	fprintf(stderr, "%d blocks, %d bad, %d records\n", count, bad, records);
+	return bad ? 2 : 0;
+}
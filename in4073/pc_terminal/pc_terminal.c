@@ -7,6 +7,7 @@
  *------------------------------------------------------------
  */
 
+#define _GNU_SOURCE /* pthread_setaffinity_np */
 #include <stdio.h>
 #include <termios.h>
 #include <unistd.h>
@@ -17,6 +18,18 @@
 #include "globals.h"
 #include "keyboard.h"
 #include "joystick.h"
+#include "rs232.h"
+#include "tx_sched.h"
+#include "frame_decoder.h"
+#include "link_stats.h"
+#include "recorder.h"
+#include "log_dump.h"
+#include "spsc_queue.h"
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
 
 
 #define NANO_SECOND_MULTIPLIER 1000000
@@ -49,19 +62,7 @@ void push_packet(char direction, char value)
 }
 
 
-/* time */
-unsigned int mon_time_ms(void)
-{
-    unsigned int    ms;
-    struct timeval  tv;
-    struct timezone tz;
-
-    gettimeofday(&tv, &tz);
-    ms = 1000 * (tv.tv_sec % 65); // 65 sec wrap around
-    ms = ms + tv.tv_usec / 1000;
-    return ms;
-}
-
+/* time, see tx_sched.c for mon_time_us() */
 void mon_delay_ms(unsigned int ms)
 {
     struct timespec req, rem;
@@ -255,113 +256,6 @@ int	term_getchar()
     return c;
 }
 
-/*------------------------------------------------------------
- * Serial I/O
- * 8 bits, 1 stopbit, no parity,
- * 115,200 baud
- *------------------------------------------------------------
- */
-#include <termios.h>
-#include <ctype.h>
-#include <fcntl.h>
-#include <unistd.h>
-#include <stdio.h>
-#include <assert.h>
-#include <time.h>
-
-int serial_device = 0;
-int fd_RS232;
-
-void rs232_open(void)
-{
-    char 		*name;
-    int 		result;
-    struct termios	tty;
-
-    fd_RS232 = open("/dev/ttyUSB0", O_RDWR | O_NOCTTY);  // Hardcode your serial port here, or request it as an argument at runtime
-
-    assert(fd_RS232>=0);
-
-    result = isatty(fd_RS232);
-    assert(result == 1);
-
-    name = ttyname(fd_RS232);
-    assert(name != 0);
-
-    result = tcgetattr(fd_RS232, &tty);
-    assert(result == 0);
-
-    tty.c_iflag = IGNBRK; /* ignore break condition */
-    tty.c_oflag = 0;
-    tty.c_lflag = 0;
-
-    tty.c_cflag = (tty.c_cflag & ~CSIZE) | CS8; /* 8 bits-per-character */
-    tty.c_cflag |= CLOCAL | CREAD; /* Ignore model status + read input */
-
-    cfsetospeed(&tty, B115200);
-    cfsetispeed(&tty, B115200);
-
-    tty.c_cc[VMIN]  = 0;
-    tty.c_cc[VTIME] = 1; // added timeout
-
-    tty.c_iflag &= ~(IXON|IXOFF|IXANY);
-
-    result = tcsetattr (fd_RS232, TCSANOW, &tty); /* non-canonical */
-
-    tcflush(fd_RS232, TCIOFLUSH); /* flush I/O buffer */
-}
-
-
-void 	rs232_close(void)
-{
-    int 	result;
-
-    result = close(fd_RS232);
-    assert (result==0);
-}
-
-
-int	rs232_getchar_nb()
-{
-    int 		result;
-    unsigned char 	c;
-
-    result = read(fd_RS232, &c, 1);
-
-    if (result == 0)
-        return -1;
-
-    else
-    {
-        assert(result == 1);
-        return (int) c;
-    }
-}
-
-
-int rs232_getchar()
-{
-    int 	c;
-    while ((c = rs232_getchar_nb()) == -1)
-        ;
-    return c;
-}
-
-
-int rs232_putchar(char c)
-{
-    int result;
-
-    do
-    {
-        result = (int) write(fd_RS232, &c, 1);
-    }
-    while (result == 0);
-
-    assert(result == 1);
-    return result;
-}
-
 /* handles the input of the keyboard, Jeffrey Miog */
 void kb_input_handler(char pressed_key)
 {
@@ -468,6 +362,37 @@ void kb_input_handler(char pressed_key)
             roll_offset+=UP;
         }
         break;
+    //one-shot commands
+    case 'F':
+        command = CMD_FLASH_BENCH;
+        break;
+    case 'L':
+        command = CMD_LOG_STATUS;
+        break;
+    case 'R':
+        command = CMD_LOG_DUMP;
+        break;
+    case 'S':
+        command = CMD_LOG_LIST;
+        break;
+    case 'N':
+        command = CMD_LOG_SELECT;
+        break;
+    case 'K':
+        command = CMD_LOG_CHANNEL;
+        break;
+    case 'T':
+        command = CMD_LOG_TRIGGER;
+        break;
+    case 'M':
+        command = CMD_MODE_TRACE;
+        break;
+    case 'U':
+        command = CMD_SCHED_STATUS;
+        break;
+    case 'P':
+        command = CMD_PROFILE_DUMP;
+        break;
     //own implementation
     case 't':
         kb_pitch = UP;
@@ -487,10 +412,10 @@ void kb_input_handler(char pressed_key)
     }
 }
 
-/* jmi */
-void print_static_offsets()
+/* jmi, formats into buf for the ui thread */
+int print_static_offsets(char *buf, int len)
 {
-    printf("PC SIDE: mode=%d, kb_yaw=%d, js_yaw=%d, kb_pitch=%d, js_pitch=%d, kb_roll=%d, js_roll=%d, kb_lift=%d, js_lift=%d, p=%d, P1=%d, P2=%d\n",mode, yaw_offset, js_yaw, pitch_offset, js_pitch, roll_offset, js_roll, lift_offset, js_lift, yaw_offset_p_up|yaw_offset_p_down, roll_pitch_offset_p1, roll_pitch_offset_p2);
+    return snprintf(buf, len, "PC SIDE: mode=%d, kb_yaw=%d, js_yaw=%d, kb_pitch=%d, js_pitch=%d, kb_roll=%d, js_roll=%d, kb_lift=%d, js_lift=%d, p=%d, P1=%d, P2=%d\n",mode, yaw_offset, js_yaw, pitch_offset, js_pitch, roll_offset, js_roll, lift_offset, js_lift, yaw_offset_p_up|yaw_offset_p_down, roll_pitch_offset_p1, roll_pitch_offset_p2);
 }
 
 /*jmi*/
@@ -561,22 +486,481 @@ void create_packet()
 }
 
 
+/*------------------------------------------------------------
+ * pipeline
+ *
+ * input capture, packet transmission, serial reception and the
+ * console/recorder each run in their own thread so a slow
+ * terminal can never hold up a control packet. they only talk
+ * through single producer single consumer queues:
+ *
+ *   input --cmd_queue--> tx --tx_events----> ui
+ *   input --frame_queue-> tx <--reply_queue-- ui
+ *   input --input_events-------------------> ui
+ *   rx    --rx_events----------------------> ui
+ *------------------------------------------------------------
+ */
+#define EVENT_DATA_SIZE     200
+#define EVENT_QUEUE_SIZE    1024
+#define CMD_QUEUE_SIZE      64
+
+#define EV_TEXT             1   // drone text, to stderr and the recorder
+#define EV_LOCAL_TEXT       2   // terminal's own messages, stderr only
+#define EV_RX_FRAME         3
+#define EV_TX_FRAME         4
+#define EV_DUMP_START       5   // the ui thread runs the log dump
+
+// the tx thread wakes up at least this often for one-shot frames
+#define TX_POLL_US          2000
+
+typedef struct {
+    uint64_t time_us;
+    uint8_t  type;
+    uint8_t  len;
+    uint8_t  data[EVENT_DATA_SIZE];
+} event_t;
+
+static spsc_queue_t cmd_queue, frame_queue, reply_queue, input_events, tx_events, rx_events;
+
+//cleared by ^C so the threads wind down and the capture gets closed
+static volatile sig_atomic_t running = 1;
+
+//session capture, only active when a file is given on the command line
+static recorder_t recorder = { .fd = -1 };
+
+//flight log dump, started with R
+static const char *dump_path = LOG_DUMP_DEFAULT_FILE;
+static int log_channels[LOG_CHANNELS];	// sent by key K, -1 leaves a channel as it is
+static log_dump_t dump;
+
+static int tx_rate = TX_RATE_DEFAULT_HZ;
+static int tx_cpu = -1;
+static int tx_priority = 0;
+
+void stop_handler(int sig)
+{
+    running = 0;
+}
+
+static void push_event_at(spsc_queue_t *q, uint64_t time_us, uint8_t type, const void *data, int len)
+{
+    event_t ev;
+
+    if (len > EVENT_DATA_SIZE)
+        len = EVENT_DATA_SIZE;
+    ev.time_us = time_us;
+    ev.type = type;
+    ev.len = len;
+    memcpy(ev.data, data, len);
+    spsc_push(q, &ev);
+}
+
+static void push_event(spsc_queue_t *q, uint8_t type, const void *data, int len)
+{
+    push_event_at(q, mon_time_us(), type, data, len);
+}
+
+static void push_text(spsc_queue_t *q, const char *text)
+{
+    push_event(q, EV_LOCAL_TEXT, text, strlen(text));
+}
+
 /* jmi */
-void tx_packet()
-{
-    //term_puts("tx packet to FCB\n");
-    rs232_putchar(mypacket.header);
-    rs232_putchar(mypacket.mode);
-    rs232_putchar(mypacket.p_adjust);
-    rs232_putchar(mypacket.lift);
-    rs232_putchar(mypacket.pitch);
-    rs232_putchar(mypacket.roll);
-    rs232_putchar(mypacket.yaw);
-    rs232_putchar(mypacket.checksum);
-   	//reseting p_adjust values
-   	yaw_offset_p_up=0;
-    yaw_offset_p_down=0;
-						
+void tx_packet(packet *p)
+{
+    uint8_t frame[sizeof(packet)];
+
+    //one write() per packet instead of one per byte
+    frame[0] = p->header;
+    frame[1] = p->mode;
+    frame[2] = p->p_adjust;
+    frame[3] = p->lift;
+    frame[4] = p->pitch;
+    frame[5] = p->roll;
+    frame[6] = p->yaw;
+    frame[7] = frame_checksum(frame, sizeof(frame));
+    rs232_write(frame, sizeof(frame));
+    push_event(&tx_events, EV_TX_FRAME, frame, sizeof(frame));
+}
+
+/* one command frame for every channel given with -L */
+static void push_log_channels(void)
+{
+    uint8_t frame[PACKET_SIZE];
+    int ch, n = 0;
+
+    for (ch = 0; ch < LOG_CHANNELS; ch++)
+    {
+        if (log_channels[ch] < 0)
+            continue;
+        make_command_frame(frame, CMD_LOG_CHANNEL, ch << 8 | log_channels[ch]);
+        spsc_push(&frame_queue, frame);
+        n++;
+    }
+    if (n == 0)
+        push_text(&input_events, "PC SIDE: no log channels given, see -L\n");
+}
+
+/*
+ * -L takes a comma separated list of presets and channel=n, log the
+ * channel every n control loop runs, 0 is off. later entries win.
+ */
+static int parse_log_channels(const char *spec)
+{
+    static const char *const names[LOG_CHANNELS] = LOG_CHANNEL_NAMES;
+    static const struct {
+        const char *name;
+        int n[LOG_CHANNELS];
+    } presets[] = {
+        // gyro, accel, attitude, motors, control, baro, battery, link
+        { "default",   { 1, 0, 1, 0, 0, 1, 1, 0 } },
+        { "vibration", { 1, 1, 0, 0, 0, 0, 0, 0 } },
+        { "endurance", { 10, 10, 10, 10, 10, 10, 10, 10 } },
+    };
+    char buf[256], *tok, *eq;
+    int ch, i;
+
+    snprintf(buf, sizeof(buf), "%s", spec);
+    for (tok = strtok(buf, ","); tok != NULL; tok = strtok(NULL, ","))
+    {
+        for (i = 0; i < (int)(sizeof(presets) / sizeof(presets[0])); i++)
+            if (strcmp(tok, presets[i].name) == 0)
+                break;
+        if (i < (int)(sizeof(presets) / sizeof(presets[0])))
+        {
+            memcpy(log_channels, presets[i].n, sizeof(log_channels));
+            continue;
+        }
+        eq = strchr(tok, '=');
+        if (eq == NULL)
+            return -1;
+        *eq = '\0';
+        for (ch = 0; ch < LOG_CHANNELS; ch++)
+            if (strcmp(tok, names[ch]) == 0)
+                break;
+        if (ch == LOG_CHANNELS || atoi(eq + 1) < 0 || atoi(eq + 1) > 255)
+            return -1;
+        log_channels[ch] = atoi(eq + 1);
+    }
+    return 0;
+}
+
+/* keyboard and joystick, owner of the offsets in globals.h */
+void *input_thread(void *arg)
+{
+    struct pollfd fds[2];
+    char c, buf[EVENT_DATA_SIZE];
+    uint8_t frame[PACKET_SIZE];
+
+    fds[0].fd = 0;
+    fds[0].events = POLLIN;
+    fds[1].fd = fd; // negative (ignored) if there is no joystick
+    fds[1].events = POLLIN;
+
+    while (running)
+    {
+        poll(fds, 2, 100);
+
+        if (fd >= 0)
+            read_js(fd);
+        while ((c = term_getchar_nb()) != -1)
+        {
+            kb_input_handler(c);
+            print_static_offsets(buf, sizeof(buf));
+            push_text(&input_events, buf);
+            if (command == CMD_LOG_DUMP)
+            {
+                push_event(&input_events, EV_DUMP_START, NULL, 0);
+                command = 0;
+            }
+            if (command == CMD_LOG_CHANNEL)
+            {
+                push_log_channels();
+                command = 0;
+            }
+            if (command)
+            {
+                make_command_frame(frame, command, 0);
+                spsc_push(&frame_queue, frame);
+                command = 0;
+            }
+        }
+
+        //hand the current command to the tx thread; the p adjust
+        //flags are one-shot, the tx thread keeps them until sent
+        create_packet();
+        spsc_push(&cmd_queue, &mypacket);
+        yaw_offset_p_up = 0;
+        yaw_offset_p_down = 0;
+    }
+    return NULL;
+}
+
+static void tx_thread_realtime(void)
+{
+    char buf[EVENT_DATA_SIZE];
+    struct sched_param param;
+    cpu_set_t set;
+    int err;
+
+    if (tx_cpu >= 0)
+    {
+        CPU_ZERO(&set);
+        CPU_SET(tx_cpu, &set);
+        if ((err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)))
+        {
+            snprintf(buf, sizeof(buf), "PC SIDE: cannot pin tx thread to cpu %d: %s\n", tx_cpu, strerror(err));
+            push_text(&tx_events, buf);
+        }
+    }
+    if (tx_priority > 0)
+    {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+            push_text(&tx_events, "PC SIDE: mlockall failed, page faults may delay packets\n");
+        param.sched_priority = tx_priority;
+        if ((err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)))
+        {
+            snprintf(buf, sizeof(buf), "PC SIDE: cannot set SCHED_FIFO %d: %s\n", tx_priority, strerror(err));
+            push_text(&tx_events, buf);
+        }
+    }
+}
+
+/* sends control packets and pings on their absolute schedules */
+void *tx_thread(void *arg)
+{
+    tx_sched_t sched, ping_sched;
+    packet latest = *(packet *) arg, p;
+    char p_adjust = 0;
+    uint8_t ping[PACKET_SIZE], frame[PACKET_SIZE], seq = 0;
+    uint64_t next, now;
+    struct timespec ts;
+    char buf[EVENT_DATA_SIZE];
+
+    tx_thread_realtime();
+    tx_sched_init(&sched, tx_rate);
+    tx_sched_init(&ping_sched, PING_RATE_HZ);
+
+    while (running)
+    {
+        next = sched.deadline_us;
+        if (ping_sched.deadline_us < next)
+            next = ping_sched.deadline_us;
+        now = mon_time_us();
+        if (now + TX_POLL_US < next)
+            next = now + TX_POLL_US;
+        ts.tv_sec = next / 1000000;
+        ts.tv_nsec = (next % 1000000) * 1000;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+        while (spsc_pop(&cmd_queue, &p))
+        {
+            latest = p;
+            p_adjust |= p.p_adjust;
+        }
+
+        //one-shot frames go out on the next wakeup, off the grid
+        while (spsc_pop(&frame_queue, frame) || spsc_pop(&reply_queue, frame))
+        {
+            rs232_write(frame, sizeof(frame));
+            push_event(&tx_events, EV_TX_FRAME, frame, sizeof(frame));
+        }
+
+        if (tx_sched_due(&sched))
+        {
+            latest.p_adjust = p_adjust;
+            tx_packet(&latest);
+            p_adjust = 0;
+            tx_sched_sent(&sched);
+        }
+
+        //round trip measurement
+        if (tx_sched_due(&ping_sched))
+        {
+            now = mon_time_us();
+            make_ping_frame(ping, seq++, now);
+            rs232_write(ping, sizeof(ping));
+            push_event_at(&tx_events, now, EV_TX_FRAME, ping, sizeof(ping));
+            tx_sched_sent(&ping_sched);
+        }
+
+        if (tx_sched_report(&sched, buf, sizeof(buf)))
+            push_text(&tx_events, buf);
+    }
+    return NULL;
+}
+
+/* reads the serial port and splits text from frames */
+void *rx_thread(void *arg)
+{
+    frame_decoder_t decoder;
+    struct pollfd pfd;
+    uint8_t buf[256];
+    char text[EVENT_DATA_SIZE];
+    int i, n, text_len = 0;
+
+    frame_decoder_init(&decoder);
+    pfd.fd = rs232_fd();
+    pfd.events = POLLIN;
+
+    while (running)
+    {
+        poll(&pfd, 1, 100);
+
+        while ((n = rs232_read(buf, sizeof(buf))) > 0)
+        {
+            for (i = 0; i < n; i++)
+            {
+                switch (frame_decoder_feed(&decoder, buf[i]))
+                {
+                case FRAME_TEXT:
+                    text[text_len++] = buf[i];
+                    if (text_len == EVENT_DATA_SIZE)
+                    {
+                        push_event(&rx_events, EV_TEXT, text, text_len);
+                        text_len = 0;
+                    }
+                    break;
+                case FRAME_DONE:
+                    push_event(&rx_events, EV_RX_FRAME, decoder.buf, decoder.len);
+                    break;
+                }
+            }
+        }
+        if (text_len)
+        {
+            push_event(&rx_events, EV_TEXT, text, text_len);
+            text_len = 0;
+        }
+    }
+    return NULL;
+}
+
+/* one line for a PROFILE frame: the times of a stage and its histogram */
+int format_profile(const uint8_t *f, char *buf, int len)
+{
+    static const char *const names[PROFILE_STAGES] = PROFILE_STAGE_NAMES;
+    uint32_t count = get_septets(&f[2], 3);
+    uint32_t total = get_septets(&f[11], 5);
+    int k, n;
+
+    if (f[1] >= PROFILE_STAGES)
+        return snprintf(buf, len, "PC SIDE: profile of unknown stage %u\n", f[1]);
+    if (count == 0)
+        return snprintf(buf, len, "PC SIDE: profile %-11s not run\n", names[f[1]]);
+
+    n = snprintf(buf, len, "PC SIDE: profile %-11s n=%u min %u mean %u max %u us, under", names[f[1]],
+        count, get_septets(&f[5], 3), total / count, get_septets(&f[8], 3));
+    for (k = 0; k < PROFILE_BUCKETS && n < len; k++)
+    {
+        uint32_t c = get_septets(&f[PROFILE_OFS_HISTOGRAM + 2 * k], 2);
+
+        if (c)
+            n += snprintf(buf + n, len - n, " %u:%u", 2u << k, c);
+    }
+    if (n < len)
+        n += snprintf(buf + n, len - n, "\n");
+    return n;
+}
+
+/* dispatches a checked frame from the drone */
+void handle_frame(link_stats_t *link, event_t *ev)
+{
+    uint8_t reply[PACKET_SIZE];
+    char buf[EVENT_DATA_SIZE];
+    int result;
+
+    switch (ev->data[0])
+    {
+    case PONG_HEADER:
+        link_stats_pong(link, ev->data, ev->time_us);
+        break;
+    case DUMP_HEADER:
+        result = log_dump_frame(&dump, ev->data, ev->time_us, reply);
+        if (result == LOG_DUMP_REPLY)
+            spsc_push(&reply_queue, reply);
+        if (result == LOG_DUMP_DONE)
+        {
+            log_dump_finish(&dump, ev->time_us, buf, sizeof(buf));
+            term_puts(buf);
+        }
+        break;
+    case PROFILE_HEADER:
+        format_profile(ev->data, buf, sizeof(buf));
+        term_puts(buf);
+        break;
+    default:
+        break;
+    }
+}
+
+/* console output, recording and statistics */
+void *ui_thread(void *arg)
+{
+    link_stats_t link;
+    event_t ev;
+    char report[EVENT_DATA_SIZE];
+    uint8_t reply[PACKET_SIZE];
+    struct timespec idle = { 0, 1000000 };
+    int i, busy = 0;
+
+    link_stats_init(&link);
+
+    while (running || busy)
+    {
+        busy = 0;
+        while (spsc_pop(&rx_events, &ev))
+        {
+            busy = 1;
+            if (ev.type == EV_TEXT)
+            {
+                fwrite(ev.data, 1, ev.len, stderr);
+                for (i = 0; i < ev.len; i++)
+                    recorder_text(&recorder, ev.time_us, ev.data[i]);
+            }
+            else
+            {
+                handle_frame(&link, &ev);
+                recorder_append(&recorder, ev.time_us, REC_RX_FRAME, ev.data, ev.len);
+            }
+        }
+        while (spsc_pop(&tx_events, &ev))
+        {
+            busy = 1;
+            if (ev.type == EV_TX_FRAME)
+            {
+                if (ev.data[0] == PING_HEADER)
+                    link_stats_ping_sent(&link, ev.data, ev.time_us);
+                recorder_append(&recorder, ev.time_us, REC_TX_FRAME, ev.data, ev.len);
+            }
+            else
+                fwrite(ev.data, 1, ev.len, stderr);
+        }
+        while (spsc_pop(&input_events, &ev))
+        {
+            busy = 1;
+            if (ev.type == EV_DUMP_START)
+            {
+                log_dump_start(&dump, dump_path, ev.time_us, reply);
+                spsc_push(&reply_queue, reply);
+                snprintf(report, sizeof(report), "PC SIDE: dumping the flight log to %s\n", dump_path);
+                term_puts(report);
+            }
+            else
+                fwrite(ev.data, 1, ev.len, stdout);
+        }
+        fflush(stdout);
+
+        if (log_dump_poll(&dump, mon_time_us(), reply) == LOG_DUMP_REPLY)
+            spsc_push(&reply_queue, reply);
+
+        if (link_stats_report(&link, report, sizeof(report)))
+            term_puts(report);
+
+        if (!busy)
+            nanosleep(&idle, NULL);
+    }
+    return NULL;
 }
 
 /*----------------------------------------------------------------
@@ -585,15 +969,73 @@ void tx_packet()
  *----------------------------------------------------------------
  */
 
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-c cpu] [-R priority] [-l file] [-L channels] [device [baud [tx rate in Hz [capture file]]]]\n"
+        "  -c cpu       pin the tx thread to this cpu\n"
+        "  -R priority  run the tx thread SCHED_FIFO at this priority\n"
+        "  -l file      where R saves the flight log (default " LOG_DUMP_DEFAULT_FILE ")\n"
+        "  -L channels  what K sets the flight log to record, e.g. vibration or default,link=50\n"
+        "               presets default, vibration, endurance; channels gyro, accel, attitude,\n"
+        "               motors, control, baro, battery, link = every n control loop runs, 0 is off\n", name);
+}
 
 int main(int argc, char **argv)
 {
-    char	c;
+    const char *device = RS232_DEFAULT_DEVICE;
+    int baud = LINK_BAUDRATE;
+    int opt;
+    packet initial;
+    pthread_t input, tx, rx, ui;
+
+    memset(log_channels, -1, sizeof(log_channels));
+    while ((opt = getopt(argc, argv, "c:R:l:L:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            tx_cpu = atoi(optarg);
+            break;
+        case 'R':
+            tx_priority = atoi(optarg);
+            break;
+        case 'l':
+            dump_path = optarg;
+            break;
+        case 'L':
+            if (parse_log_channels(optarg) < 0)
+            {
+                fprintf(stderr, "bad log channels %s\n", optarg);
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    if (argc > 1)
+        device = argv[1];
+    if (argc > 2)
+        baud = atoi(argv[2]);
+    if (argc > 3)
+        tx_rate = atoi(argv[3]);
+    if (!rs232_baud_supported(baud))
+    {
+        fprintf(stderr, "unsupported baud rate %d\n", baud);
+        return 1;
+    }
+    if (argc > 4 && recorder_open(&recorder, argv[4]) < 0)
+        return 1;
 
     term_puts("\nTerminal program - Embedded Real-Time Systems\n");
 
     term_initio();
-    rs232_open();
+    rs232_open(device, baud);
 
     /* display keyboard mapping */
     term_puts("keyboard mapping:\n");
@@ -602,43 +1044,39 @@ int main(int argc, char **argv)
     term_puts("up:\t	pitch_offset up\n 'down':\t	ptich_offset down\n");
     term_puts("right:\t	roll_offset up\n 'right':	roll_offset down \n");
     term_puts("P CONTROLLERS TO BE ADDED \n");
+    term_puts("F:\t	flash benchmark, L: log status, R: dump flight log, M: mode transitions, U: task and interrupt load, P: stage timing (safe mode only)\n");
 
     term_puts("\nType ^C to exit\n");
 
 
     joystick_init();
-    
-	unsigned int old_time, current_time;
-	old_time = mon_time_ms();
 
-    while(1)
+    if (spsc_init(&cmd_queue, CMD_QUEUE_SIZE, sizeof(packet)) < 0 ||
+        spsc_init(&frame_queue, CMD_QUEUE_SIZE, PACKET_SIZE) < 0 ||
+        spsc_init(&reply_queue, CMD_QUEUE_SIZE, PACKET_SIZE) < 0 ||
+        spsc_init(&input_events, EVENT_QUEUE_SIZE, sizeof(event_t)) < 0 ||
+        spsc_init(&tx_events, EVENT_QUEUE_SIZE, sizeof(event_t)) < 0 ||
+        spsc_init(&rx_events, EVENT_QUEUE_SIZE, sizeof(event_t)) < 0)
     {
-	
-	//read messages from the board 
-        if ((c = rs232_getchar_nb()) != -1)
-        {
-             term_putchar(c);
-        }
+        perror("queues");
+        return 1;
+    }
 
-	//construct message to the board	
-	read_js(fd);
-        while ((c = term_getchar_nb()) != -1)
-        {
-            kb_input_handler(c);
-	    print_static_offsets();
-        }
+    create_packet();
+    initial = mypacket;
+    signal(SIGINT, stop_handler);
+
+    pthread_create(&ui, NULL, ui_thread, NULL);
+    pthread_create(&rx, NULL, rx_thread, NULL);
+    pthread_create(&tx, NULL, tx_thread, &initial);
+    pthread_create(&input, NULL, input_thread, NULL);
 
-     
-	//send messages to the board
-	current_time=mon_time_ms();	
-	if((current_time - old_time) > 100)
-	{
-        	create_packet();
-		tx_packet();
-		old_time=current_time;
-	}
-     }
+    pthread_join(input, NULL);
+    pthread_join(tx, NULL);
+    pthread_join(rx, NULL);
+    pthread_join(ui, NULL);
 
+    recorder_close(&recorder);
     term_exitio();
     rs232_close();
     term_puts("\n<exit>\n");
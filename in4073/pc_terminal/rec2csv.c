@@ -0,0 +1,154 @@
+/*------------------------------------------------------------
+ * rec2csv.c -- converts a pc terminal capture to csv
+ *
+ * usage: rec2csv capture.bin > capture.csv
+ *
+ * columns: time in s since the first record, direction and
+ * frame type, then the decoded fields of that frame. text
+ * records go in the last column.
+ *------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../protocol/protocol.h"
+#include "recorder.h"
+
+static void print_text(const rec_t *rec)
+{
+	int i;
+
+	putchar('"');
+	for (i = 0; i < rec->len; i++)
+	{
+		char c = rec->data[i];
+
+		if (c == '"')
+			fputs("\"\"", stdout);
+		else if (c == '\n' || c == '\r')
+			continue;
+		else
+			putchar(c);
+	}
+	putchar('"');
+}
+
+static void print_frame(const char *dir, const rec_t *rec)
+{
+	const uint8_t *f = rec->data;
+
+	switch (f[0])
+	{
+	case HEADER_VALUE:
+		// uplink control packet; signed 7 bit values
+		printf("%s,control,%d,%d,%d,%d,%d,%d,,", dir, f[1], f[2],
+			(int8_t) (f[3] << 1) >> 1, (int8_t) (f[4] << 1) >> 1,
+			(int8_t) (f[5] << 1) >> 1, (int8_t) (f[6] << 1) >> 1);
+		break;
+	case PING_HEADER:	// == PONG_HEADER, told apart by direction
+		if (dir[0] == 't')
+			printf("%s,ping,%u,%u,,,,,,", dir, f[1], get_septets(&f[2], 4));
+		else
+			printf("%s,pong,%u,%u,%u,%u,%u,%u,,", dir, f[1], get_septets(&f[2], 4),
+				get_septets(&f[6], 2), get_septets(&f[8], 2), get_septets(&f[10], 2),
+				get_septets(&f[12], 2));
+		break;
+	case CMD_HEADER:	// == DUMP_HEADER, told apart by direction
+		if (dir[0] == 't')
+			printf("%s,command,%u,%u,,,,,,", dir, f[1], get_septets(&f[2], 4));
+		else
+			printf("%s,dump,%u,%u,,,,,,", dir, f[1], get_septets(&f[2], 3));
+		break;
+	case PROFILE_HEADER:
+		printf("%s,profile,%u,%u,%u,%u,%u,,,", dir, f[1], get_septets(&f[2], 3),
+			get_septets(&f[5], 3), get_septets(&f[8], 3), get_septets(&f[11], 5));
+		break;
+	default:
+		printf("%s,0x%02x,,,,,,,,", dir, f[0]);
+		break;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct stat st;
+	const rec_header_t *hdr;
+	const rec_t *rec;
+	uint8_t *map;
+	uint64_t i, count, t0 = 0;
+	int fd;
+
+	if (argc != 2)
+	{
+		fprintf(stderr, "usage: %s capture.bin\n", argv[0]);
+		return 1;
+	}
+
+	fd = open(argv[1], O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < REC_HEADER_SIZE)
+	{
+		perror(argv[1]);
+		return 1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		perror("mmap");
+		return 1;
+	}
+
+	hdr = (const rec_header_t *) map;
+	if (hdr->magic != REC_MAGIC || hdr->rec_size != REC_SIZE)
+	{
+		fprintf(stderr, "%s: not a capture file\n", argv[1]);
+		return 1;
+	}
+
+	// trust the file size over the header if the capture was cut short
+	count = hdr->count;
+	if (REC_HEADER_SIZE + count * REC_SIZE > (uint64_t) st.st_size)
+		count = (st.st_size - REC_HEADER_SIZE) / REC_SIZE;
+
+	printf("time_s,dir,type,f1,f2,f3,f4,f5,f6,unix_time_s,text\n");
+	for (i = 0; i < count; i++)
+	{
+		rec = (const rec_t *) (map + REC_HEADER_SIZE + i * REC_SIZE);
+		if (i == 0)
+			t0 = rec->time_us;
+		printf("%.6f,", (rec->time_us - t0) / 1e6);
+
+		switch (rec->type)
+		{
+		case REC_TX_FRAME:
+			print_frame("tx", rec);
+			break;
+		case REC_RX_FRAME:
+			print_frame("rx", rec);
+			break;
+		case REC_RX_TEXT:
+			printf("rx,text,,,,,,,,");
+			print_text(rec);
+			break;
+		case REC_INDEX:
+		{
+			uint64_t idx[2];
+
+			memcpy(idx, rec->data, sizeof(idx));
+			printf("-,index,%llu,,,,,,%.6f,", (unsigned long long) idx[0], idx[1] / 1e6);
+			break;
+		}
+		default:
+			printf("-,unknown,,,,,,,,");
+			break;
+		}
+		putchar('\n');
+	}
+
+	munmap(map, st.st_size);
+	close(fd);
+	return 0;
+}
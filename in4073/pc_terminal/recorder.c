@@ -0,0 +1,140 @@
+/*------------------------------------------------------------
+ * recorder.c -- memory mapped session capture for the pc terminal
+ *
+ * appending is a memcpy into the mapping, the kernel writes the
+ * pages back in the background. the header count is updated
+ * after every record, so a capture cut short by a crash is
+ * still readable up to the last complete record.
+ *------------------------------------------------------------
+ */
+
+#define _GNU_SOURCE /* mremap */
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include "recorder.h"
+
+static int recorder_grow(recorder_t *r)
+{
+	size_t size = r->map_size + REC_GROW_SIZE;
+	void *map;
+
+	if (ftruncate(r->fd, size) < 0)
+		return -1;
+
+	if (r->map)
+		map = mremap(r->map, r->map_size, size, MREMAP_MAYMOVE);
+	else
+		map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+
+	r->map = map;
+	r->map_size = size;
+	r->hdr = (rec_header_t *) r->map;
+	return 0;
+}
+
+int recorder_open(recorder_t *r, const char *path)
+{
+	struct timeval tv;
+
+	memset(r, 0, sizeof(*r));
+	r->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (r->fd < 0 || recorder_grow(r) < 0)
+	{
+		perror("recorder");
+		if (r->fd >= 0)
+			close(r->fd);
+		r->fd = -1;
+		return -1;
+	}
+
+	gettimeofday(&tv, NULL);
+	r->hdr->magic = REC_MAGIC;
+	r->hdr->version = REC_VERSION;
+	r->hdr->rec_size = REC_SIZE;
+	r->hdr->count = 0;
+	r->hdr->start_unix_us = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+	r->hdr->index_interval = REC_INDEX_INTERVAL;
+	return 0;
+}
+
+void recorder_close(recorder_t *r)
+{
+	size_t used;
+
+	if (r->fd < 0 || !r->map)
+		return;
+
+	used = REC_HEADER_SIZE + r->hdr->count * REC_SIZE;
+	munmap(r->map, r->map_size);
+	if (ftruncate(r->fd, used) < 0)
+		perror("recorder");
+	close(r->fd);
+	r->map = NULL;
+	r->fd = -1;
+}
+
+static rec_t *recorder_slot(recorder_t *r)
+{
+	size_t offset = REC_HEADER_SIZE + r->hdr->count * REC_SIZE;
+
+	if (offset + REC_SIZE > r->map_size && recorder_grow(r) < 0)
+		return NULL;
+	return (rec_t *) (r->map + offset);
+}
+
+static void recorder_put(recorder_t *r, uint64_t now, uint8_t type, const void *data, int len)
+{
+	rec_t *rec = recorder_slot(r);
+
+	if (!rec)
+		return;
+	if (len > REC_DATA_SIZE)
+		len = REC_DATA_SIZE;
+
+	rec->time_us = now;
+	rec->type = type;
+	rec->len = len;
+	rec->reserved = 0;
+	memcpy(rec->data, data, len);
+	memset(rec->data + len, 0, REC_DATA_SIZE - len);
+	r->hdr->count++;
+}
+
+/* time_us is CLOCK_MONOTONIC, see mon_time_us() */
+void recorder_append(recorder_t *r, uint64_t now, uint8_t type, const uint8_t *data, int len)
+{
+	uint64_t idx[2];
+	struct timeval tv;
+
+	if (r->fd < 0 || !r->map)
+		return;
+
+	if (r->hdr->count % REC_INDEX_INTERVAL == 0)
+	{
+		gettimeofday(&tv, NULL);
+		idx[0] = r->hdr->count;
+		idx[1] = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+		recorder_put(r, now, REC_INDEX, idx, sizeof(idx));
+	}
+	recorder_put(r, now, type, data, len);
+}
+
+/* collects drone text, one record per line (or per REC_DATA_SIZE chunk) */
+void recorder_text(recorder_t *r, uint64_t now, char c)
+{
+	if (r->fd < 0 || !r->map)
+		return;
+
+	r->text[r->text_len++] = c;
+	if (c == '\n' || r->text_len == REC_DATA_SIZE)
+	{
+		recorder_append(r, now, REC_RX_TEXT, (uint8_t *) r->text, r->text_len);
+		r->text_len = 0;
+	}
+}
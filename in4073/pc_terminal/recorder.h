@@ -0,0 +1,63 @@
+#ifndef RECORDER_H__
+#define RECORDER_H__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/*------------------------------------------------------------
+ * recorder -- append-only binary capture of a session
+ *
+ * the file is a REC_HEADER_SIZE header followed by fixed size
+ * records, written through a shared memory mapping that grows
+ * in REC_GROW_SIZE steps. every REC_INDEX_INTERVAL records an
+ * index record with the wall clock time is inserted so long
+ * captures can be lined up with other logs.
+ *------------------------------------------------------------
+ */
+
+#define REC_MAGIC		0x31524351	// "QCR1"
+#define REC_VERSION		1
+#define REC_HEADER_SIZE		4096
+#define REC_SIZE		64
+#define REC_DATA_SIZE		(REC_SIZE - 12)
+#define REC_GROW_SIZE		(1 << 20)
+#define REC_INDEX_INTERVAL	1024
+
+// record types
+#define REC_TX_FRAME		1	// uplink frame as sent
+#define REC_RX_FRAME		2	// checked downlink frame
+#define REC_RX_TEXT		3	// chunk of drone printf output
+#define REC_INDEX		4	// data: record number (8), unix time in us (8)
+
+typedef struct {
+	uint64_t time_us;		// CLOCK_MONOTONIC
+	uint8_t  type;
+	uint8_t  len;
+	uint16_t reserved;
+	uint8_t  data[REC_DATA_SIZE];
+} rec_t;
+
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t rec_size;
+	uint64_t count;			// records written, kept current
+	uint64_t start_unix_us;
+	uint32_t index_interval;
+} rec_header_t;
+
+typedef struct {
+	int      fd;
+	uint8_t  *map;
+	size_t   map_size;
+	rec_header_t *hdr;
+	char     text[REC_DATA_SIZE];
+	int      text_len;
+} recorder_t;
+
+int  recorder_open(recorder_t *r, const char *path);
+void recorder_close(recorder_t *r);
+void recorder_append(recorder_t *r, uint64_t time_us, uint8_t type, const uint8_t *data, int len);
+void recorder_text(recorder_t *r, uint64_t time_us, char c);
+
+#endif
@@ -2,19 +2,64 @@
 /*------------------------------------------------------------
  * Serial I/O
  * 8 bits, 1 stopbit, no parity,
- * 115,200 baud
+ * 115,200 baud by default, up to 1M (nRF51 UART limit)
+ *
+ * Reads go through a user-space rx buffer so that one read()
+ * syscall drains everything the driver has, instead of one
+ * syscall per byte. Writes go out as whole blocks.
  *------------------------------------------------------------
  */
 
- #include "term_init.h"
+#include <errno.h>
+#include <string.h>
+
+static int	fd_RS232 = -1;
+
+static uint8_t	rx_buf[RS232_RX_BUF_SIZE];
+static int	rx_head, rx_tail;
+
+static const struct {
+	int	baud;
+	speed_t	speed;
+} baud_table[] = {
+	{   9600, B9600 },
+	{  19200, B19200 },
+	{  38400, B38400 },
+	{  57600, B57600 },
+	{ 115200, B115200 },
+	{ 230400, B230400 },
+	{ 460800, B460800 },
+	{ 921600, B921600 },
+	{1000000, B1000000 },
+};
+
+static speed_t baud_to_speed(int baud)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(baud_table) / sizeof(baud_table[0]); i++)
+		if (baud_table[i].baud == baud)
+			return baud_table[i].speed;
+
+	return B0;
+}
+
+int rs232_baud_supported(int baud)
+{
+	return baud_to_speed(baud) != B0;
+}
 
-void rs232_open(void)
+void rs232_open(const char *device, int baud)
 {
   	char 		*name;
   	int 		result;
   	struct termios	tty;
+	speed_t		speed;
 
-       	fd_RS232 = open("/dev/ttyUSB0", O_RDWR | O_NOCTTY);  // Hardcode your serial port here, or request it as an argument at runtime
+	speed = baud_to_speed(baud);
+	assert(speed != B0);
+
+       	fd_RS232 = open(device, O_RDWR | O_NOCTTY);
 
 	assert(fd_RS232>=0);
 
@@ -34,17 +79,19 @@ void rs232_open(void)
 	tty.c_cflag = (tty.c_cflag & ~CSIZE) | CS8; /* 8 bits-per-character */
 	tty.c_cflag |= CLOCAL | CREAD; /* Ignore model status + read input */
 
-	cfsetospeed(&tty, B115200);
-	cfsetispeed(&tty, B115200);
+	cfsetospeed(&tty, speed);
+	cfsetispeed(&tty, speed);
 
 	tty.c_cc[VMIN]  = 0;
-	tty.c_cc[VTIME] = 1; // added timeout
+	tty.c_cc[VTIME] = 0; // non-blocking, callers poll() rs232_fd()
 
 	tty.c_iflag &= ~(IXON|IXOFF|IXANY);
 
 	result = tcsetattr (fd_RS232, TCSANOW, &tty); /* non-canonical */
 
 	tcflush(fd_RS232, TCIOFLUSH); /* flush I/O buffer */
+
+	rx_head = rx_tail = 0;
 }
 
 
@@ -54,86 +101,96 @@ void rs232_close(void)
 
   	result = close(fd_RS232);
   	assert (result==0);
+	fd_RS232 = -1;
 }
 
 
-int	rs232_getchar_nb()
+int rs232_fd(void)
 {
-	int 		result;
-	unsigned char 	c;
-
-	result = read(fd_RS232, &c, 1);
-
-	if (result == 0)
-		return -1;
-
-	else
-	{
-		assert(result == 1);
-		return (int) c;
-	}
+	return fd_RS232;
 }
 
 
-int 	rs232_getchar()
+/* refill the rx buffer with a single read(), returns bytes added */
+static int rs232_fill(void)
 {
-	int 	c;
-
-	while ((c = rs232_getchar_nb()) == -1)
-		;
-	return c;
-}
+	int result;
 
+	if (rx_head == rx_tail)
+		rx_head = rx_tail = 0;
 
-int 	rs232_putchar(char c)
-{
-	int result;
+	if (rx_tail == RS232_RX_BUF_SIZE)
+		return 0;
 
 	do {
-		result = (int) write(fd_RS232, &c, 1);
-	} while (result == 0);
+		result = read(fd_RS232, &rx_buf[rx_tail], RS232_RX_BUF_SIZE - rx_tail);
+	} while (result < 0 && errno == EINTR);
+
+	if (result <= 0)
+		return 0;
 
-	assert(result == 1);
+	rx_tail += result;
 	return result;
 }
 
 
-/*----------------------------------------------------------------
- * main -- execute terminal
- *----------------------------------------------------------------
- */
- /*
-int old_main(int argc, char **argv)
+/* copy up to len buffered bytes to buf, returns the number copied (0 if none available) */
+int rs232_read(uint8_t *buf, int len)
 {
-	char	c;
+	int n;
 
-	term_puts("\nTerminal program - Embedded Real-Time Systems\n");
+	if (rx_head == rx_tail)
+		rs232_fill();
 
-	term_initio();
-	rs232_open();
+	n = rx_tail - rx_head;
+	if (n > len)
+		n = len;
 
-	term_puts("Type ^C to exit\n");
+	memcpy(buf, &rx_buf[rx_head], n);
+	rx_head += n;
+	return n;
+}
 
-	// discard any incoming text
-	while ((c = rs232_getchar_nb()) != -1)
-		fputc(c,stderr);
 
-	// send & receive
-	for (;;)
+/* write the whole block, looping on partial writes */
+int rs232_write(const uint8_t *buf, int len)
+{
+	int result, done = 0;
+
+	while (done < len)
 	{
-		if ((c = term_getchar_nb()) != -1)
-			rs232_putchar(c);
+		result = (int) write(fd_RS232, buf + done, len - done);
+		if (result < 0 && errno == EINTR)
+			continue;
+		assert(result >= 0);
+		done += result;
+	}
+	return done;
+}
 
-		if ((c = rs232_getchar_nb()) != -1)
-			term_putchar(c);
 
-	}
+int	rs232_getchar_nb()
+{
+	uint8_t c;
+
+	if (rs232_read(&c, 1) == 0)
+		return -1;
+
+	return (int) c;
+}
 
-	term_exitio();
-	rs232_close();
-	term_puts("\n<exit>\n");
 
-	return 0;
+int 	rs232_getchar()
+{
+	int 	c;
+
+	while ((c = rs232_getchar_nb()) == -1)
+		;
+	return c;
 }
-*/
 
+
+int 	rs232_putchar(char c)
+{
+	return rs232_write((uint8_t *) &c, 1);
+}
@@ -1,4 +1,3 @@
-
 #ifndef RS232_H__
 #define RS232_H__
 
@@ -9,14 +8,21 @@
 #include <stdio.h>
 #include <assert.h>
 #include <time.h>
+#include <inttypes.h>
 
-//int serial_device = 0;
-int fd_RS232;
+#define RS232_DEFAULT_DEVICE	"/dev/ttyUSB0"
+#define RS232_RX_BUF_SIZE	1024
 
-void rs232_open(void);
+void rs232_open(const char *device, int baud);
 void rs232_close(void);
-int	rs232_getchar_nb();
-int rs232_getchar();
-int rs232_putchar(char c);
+int  rs232_fd(void);
+int  rs232_baud_supported(int baud);
+
+int  rs232_read(uint8_t *buf, int len);
+int  rs232_write(const uint8_t *buf, int len);
+
+int  rs232_getchar_nb();
+int  rs232_getchar();
+int  rs232_putchar(char c);
 
 #endif
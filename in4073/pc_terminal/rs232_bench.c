@@ -0,0 +1,151 @@
+/*------------------------------------------------------------
+ * rs232_bench.c -- host throughput benchmark for rs232.c
+ *
+ * Runs the serial layer against a pty pair so no hardware is
+ * needed: the slave end is opened with rs232_open() like a
+ * real port, the master end plays the drone.
+ *
+ * usage: rs232-bench [packets [baud]]
+ *------------------------------------------------------------
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include "rs232.h"
+
+#define PACKET_SIZE	8
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* read and discard everything the terminal side wrote */
+static void drain(int fd, long bytes)
+{
+	uint8_t buf[4096];
+	int n;
+
+	while (bytes > 0)
+	{
+		n = read(fd, buf, sizeof(buf));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		bytes -= n;
+	}
+}
+
+static void report(const char *what, long bytes, long calls, double t)
+{
+	printf("%-26s %8ld bytes %8ld calls %8.3f ms %10.0f B/s %8.2f us/call\n",
+		what, bytes, calls, t * 1e3, bytes / t, t * 1e6 / calls);
+}
+
+int main(int argc, char **argv)
+{
+	int packets = 20000, baud = 115200;
+	int master, i, j, n;
+	long got;
+	double t0, t;
+	uint8_t frame[PACKET_SIZE], buf[256];
+
+	if (argc > 1)
+		packets = atoi(argv[1]);
+	if (argc > 2)
+		baud = atoi(argv[2]);
+	if (!rs232_baud_supported(baud))
+	{
+		fprintf(stderr, "unsupported baud rate %d\n", baud);
+		return 1;
+	}
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) || unlockpt(master))
+	{
+		perror("pty");
+		return 1;
+	}
+	rs232_open(ptsname(master), baud);
+
+	for (i = 0; i < PACKET_SIZE; i++)
+		frame[i] = i;
+
+	/* tx: one syscall per byte, the old tx_packet() */
+	t0 = now_s();
+	for (i = 0; i < packets; i++)
+	{
+		for (j = 0; j < PACKET_SIZE; j++)
+			rs232_putchar(frame[j]);
+		if ((i & 63) == 63)
+			drain(master, 64 * PACKET_SIZE);
+	}
+	t = now_s() - t0;
+	drain(master, (packets & 63) * PACKET_SIZE);
+	report("tx rs232_putchar x8", (long) packets * PACKET_SIZE, (long) packets * PACKET_SIZE, t);
+
+	/* tx: one syscall per packet */
+	t0 = now_s();
+	for (i = 0; i < packets; i++)
+	{
+		rs232_write(frame, PACKET_SIZE);
+		if ((i & 63) == 63)
+			drain(master, 64 * PACKET_SIZE);
+	}
+	t = now_s() - t0;
+	drain(master, (packets & 63) * PACKET_SIZE);
+	report("tx rs232_write", (long) packets * PACKET_SIZE, packets, t);
+
+	/* rx: drone side sends bursts, terminal drains byte by byte via the buffer */
+	got = 0;
+	n = 0;
+	t0 = now_s();
+	for (i = 0; i < packets; i += 64)
+	{
+		for (j = 0; j < 64; j++)
+			if (write(master, frame, PACKET_SIZE) != PACKET_SIZE)
+				return 1;
+		while (got < (long) (i + 64) * PACKET_SIZE)
+		{
+			if (rs232_getchar_nb() != -1)
+				got++;
+			n++;
+		}
+	}
+	t = now_s() - t0;
+	report("rx rs232_getchar_nb", got, n, t);
+
+	/* rx: block reads */
+	got = 0;
+	n = 0;
+	t0 = now_s();
+	for (i = 0; i < packets; i += 64)
+	{
+		for (j = 0; j < 64; j++)
+			if (write(master, frame, PACKET_SIZE) != PACKET_SIZE)
+				return 1;
+		while (got < (long) (i + 64) * PACKET_SIZE)
+		{
+			got += rs232_read(buf, sizeof(buf));
+			n++;
+		}
+	}
+	t = now_s() - t0;
+	report("rx rs232_read", got, n, t);
+
+	printf("wire limit at %d baud: %d B/s\n", baud, baud / 10);
+
+	rs232_close();
+	close(master);
+	return 0;
+}
@@ -0,0 +1,78 @@
+#ifndef SPSC_QUEUE_H__
+#define SPSC_QUEUE_H__
+
+/*------------------------------------------------------------
+ * spsc_queue -- lock-free single producer, single consumer ring
+ *
+ * fixed size elements, capacity a power of two. head is only
+ * written by the consumer and tail only by the producer; the
+ * release store on one side pairs with the acquire load on the
+ * other so the element copy is visible before the index moves.
+ * a full queue makes push fail instead of blocking.
+ *------------------------------------------------------------
+ */
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	_Alignas(64) atomic_size_t head;	// next slot to pop
+	_Alignas(64) atomic_size_t tail;	// next slot to push
+	_Alignas(64) size_t mask;
+	size_t   elem_size;
+	unsigned char *buf;
+	atomic_uint dropped;			// pushes that found the queue full
+} spsc_queue_t;
+
+static inline int spsc_init(spsc_queue_t *q, size_t capacity, size_t elem_size)
+{
+	if (capacity == 0 || (capacity & (capacity - 1)))
+		return -1;
+	q->buf = malloc(capacity * elem_size);
+	if (!q->buf)
+		return -1;
+	atomic_init(&q->head, 0);
+	atomic_init(&q->tail, 0);
+	atomic_init(&q->dropped, 0);
+	q->mask = capacity - 1;
+	q->elem_size = elem_size;
+	return 0;
+}
+
+static inline void spsc_free(spsc_queue_t *q)
+{
+	free(q->buf);
+	q->buf = NULL;
+}
+
+/* producer side, returns 0 when the queue is full */
+static inline int spsc_push(spsc_queue_t *q, const void *elem)
+{
+	size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+
+	if (tail - head > q->mask)
+	{
+		atomic_fetch_add_explicit(&q->dropped, 1, memory_order_relaxed);
+		return 0;
+	}
+	memcpy(q->buf + (tail & q->mask) * q->elem_size, elem, q->elem_size);
+	atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+	return 1;
+}
+
+/* consumer side, returns 0 when the queue is empty */
+static inline int spsc_pop(spsc_queue_t *q, void *elem)
+{
+	size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+
+	if (head == tail)
+		return 0;
+	memcpy(elem, q->buf + (head & q->mask) * q->elem_size, q->elem_size);
+	atomic_store_explicit(&q->head, head + 1, memory_order_release);
+	return 1;
+}
+
+#endif
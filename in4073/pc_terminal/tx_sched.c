@@ -0,0 +1,98 @@
+/*------------------------------------------------------------
+ * tx_sched.c -- drift-free packet scheduling for the pc terminal
+ *
+ * The drone drops to panic mode when nothing arrives for 500 ms,
+ * so the ground side keeps a fixed-rate schedule on the
+ * monotonic clock and reports how far it strays from it.
+ *------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include "tx_sched.h"
+
+uint64_t mon_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void tx_sched_reset_stats(tx_sched_t *s, uint64_t now)
+{
+	s->sent = 0;
+	s->skipped = 0;
+	s->jitter_sum_us = 0;
+	s->jitter_max_us = 0;
+	s->gap_max_us = 0;
+	s->report_us = now + TX_REPORT_PERIOD_US;
+}
+
+void tx_sched_init(tx_sched_t *s, int rate_hz)
+{
+	uint64_t now = mon_time_us();
+
+	if (rate_hz < TX_RATE_MIN_HZ)
+		rate_hz = TX_RATE_MIN_HZ;
+	if (rate_hz > TX_RATE_MAX_HZ)
+		rate_hz = TX_RATE_MAX_HZ;
+
+	s->period_us = 1000000 / rate_hz;
+	s->deadline_us = now;
+	s->last_sent_us = now;
+	tx_sched_reset_stats(s, now);
+}
+
+/* time until the next deadline, negative when overdue */
+int64_t tx_sched_time_left_us(tx_sched_t *s)
+{
+	return (int64_t) (s->deadline_us - mon_time_us());
+}
+
+int tx_sched_due(tx_sched_t *s)
+{
+	return tx_sched_time_left_us(s) <= 0;
+}
+
+/* call right after a packet went out for the current deadline */
+void tx_sched_sent(tx_sched_t *s)
+{
+	uint64_t now = mon_time_us();
+	uint64_t jitter = now - s->deadline_us;
+	uint64_t gap = now - s->last_sent_us;
+
+	s->sent++;
+	s->jitter_sum_us += jitter;
+	if (jitter > s->jitter_max_us)
+		s->jitter_max_us = jitter;
+	if (gap > s->gap_max_us)
+		s->gap_max_us = gap;
+	s->last_sent_us = now;
+
+	// advance on the absolute grid; after a stall skip the missed
+	// slots rather than sending a burst to catch up
+	s->deadline_us += s->period_us;
+	while (s->deadline_us <= now)
+	{
+		s->deadline_us += s->period_us;
+		s->skipped++;
+	}
+}
+
+/* formats a jitter report into buf once per TX_REPORT_PERIOD_US, returns 0 otherwise */
+int tx_sched_report(tx_sched_t *s, char *buf, int len)
+{
+	uint64_t now = mon_time_us();
+	int n;
+
+	if (now < s->report_us || s->sent == 0)
+		return 0;
+
+	n = snprintf(buf, len, "PC SIDE: tx %u Hz, sent=%u, skipped=%u, jitter avg=%u us max=%u us, max gap=%u us\n",
+		(unsigned) (1000000 / s->period_us), s->sent, s->skipped,
+		(unsigned) (s->jitter_sum_us / s->sent), (unsigned) s->jitter_max_us,
+		(unsigned) s->gap_max_us);
+	tx_sched_reset_stats(s, now);
+	return n;
+}
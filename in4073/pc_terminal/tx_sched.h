@@ -0,0 +1,41 @@
+#ifndef TX_SCHED_H__
+#define TX_SCHED_H__
+
+#include <inttypes.h>
+
+/*------------------------------------------------------------
+ * tx_sched -- absolute-deadline scheduling of control packets
+ *
+ * Deadlines are kept on CLOCK_MONOTONIC and advance by a fixed
+ * period, so a late send does not push the following ones back.
+ *------------------------------------------------------------
+ */
+
+#define TX_RATE_MIN_HZ		10
+#define TX_RATE_MAX_HZ		200
+#define TX_RATE_DEFAULT_HZ	20
+#define TX_REPORT_PERIOD_US	5000000
+
+typedef struct {
+	uint64_t period_us;
+	uint64_t deadline_us;		// next send is due at this time
+	uint64_t last_sent_us;
+
+	// jitter statistics since the last report
+	uint32_t sent;
+	uint32_t skipped;		// whole periods lost to stalls
+	uint64_t jitter_sum_us;
+	uint64_t jitter_max_us;
+	uint64_t gap_max_us;		// longest interval between two sends
+	uint64_t report_us;
+} tx_sched_t;
+
+uint64_t mon_time_us(void);
+
+void     tx_sched_init(tx_sched_t *s, int rate_hz);
+int64_t  tx_sched_time_left_us(tx_sched_t *s);
+int      tx_sched_due(tx_sched_t *s);
+void     tx_sched_sent(tx_sched_t *s);
+int      tx_sched_report(tx_sched_t *s, char *buf, int len);
+
+#endif
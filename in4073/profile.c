@@ -0,0 +1,94 @@
+/*------------------------------------------------------------------
+ *  profile.c -- statistics of the control loop stages, see profile.h
+ *
+ *  jmi
+ *------------------------------------------------------------------
+ */
+
+#include <string.h>
+#include "in4073.h"
+#include "profile.h"
+
+#ifdef PROFILE
+
+typedef struct {
+	uint32_t count;
+	uint32_t total_us;
+	uint16_t min_us;
+	uint16_t max_us;
+	uint16_t histogram[PROFILE_BUCKETS];	// saturates at 14 bits
+} profile_stage_t;
+
+uint16_t profile_start[PROFILE_STAGES];
+static profile_stage_t profile_stats[PROFILE_STAGES];
+
+void profile_record(uint8_t stage, uint16_t start)
+{
+	profile_stage_t *s = &profile_stats[stage];
+	uint16_t us = profile_now() - start;
+	int k;
+
+	if (s->count == 0 || us < s->min_us)
+	{
+		s->min_us = us;
+	}
+	if (us > s->max_us)
+	{
+		s->max_us = us;
+	}
+	s->count++;
+	s->total_us += us;
+
+	for (k = 0; us > 1 && k < PROFILE_BUCKETS - 1; us >>= 1)
+	{
+		k++;
+	}
+	if (s->histogram[k] < 0x3FFF)
+	{
+		s->histogram[k]++;
+	}
+}
+
+/*------------------------------------------------------------------
+ * sends a PROFILE frame for each stage, then clears the statistics
+ *------------------------------------------------------------------
+ */
+void profile_dump(void)
+{
+	uint8_t f[PROFILE_SIZE];
+	profile_stage_t *s;
+	int stage, i, k;
+
+	for (stage = 0; stage < PROFILE_STAGES; stage++)
+	{
+		s = &profile_stats[stage];
+		f[0] = PROFILE_HEADER;
+		f[1] = stage;
+		put_septets(&f[2], s->count, 3);
+		put_septets(&f[5], s->min_us, 3);
+		put_septets(&f[8], s->max_us, 3);
+		put_septets(&f[11], s->total_us, 5);
+		for (k = 0; k < PROFILE_BUCKETS; k++)
+		{
+			put_septets(&f[PROFILE_OFS_HISTOGRAM + 2 * k], s->histogram[k], 2);
+		}
+		f[PROFILE_SIZE-1] = frame_checksum(f, PROFILE_SIZE);
+
+		for (i = 0; i < PROFILE_SIZE; i++)
+		{
+			uart_put(f[i]);
+		}
+		//let the tx queue drain
+		nrf_delay_ms(6);
+	}
+	memset(profile_stats, 0, sizeof(profile_stats));
+}
+
+#else
+
+void profile_dump(void)
+{
+	printf("PROFILE: not in this build, build with -DPROFILE\n");
+}
+
+#endif
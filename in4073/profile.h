@@ -0,0 +1,58 @@
+#ifndef PROFILE_H__
+#define PROFILE_H__
+
+/*------------------------------------------------------------------
+ * profile.h -- timing of the control loop stages
+ *
+ * build with -DPROFILE to have PROFILE_BEGIN() and PROFILE_END()
+ * take the TIMER2 count at the boundaries of a stage (the stages
+ * are in protocol/protocol.h) and add the time in between to its
+ * count, min, max, total and histogram. profile_dump() sends them
+ * as PROFILE frames. without it the macros are empty.
+ *------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include "protocol/protocol.h"
+
+#ifdef HOST
+
+uint16_t profile_now(void);	// host/timers.c
+
+#else
+
+/* the low 16 bits of the microsecond timer. an interrupt reading the
+ * time in between would move CC[3] on. isr_stats.h uses it as well */
+static inline uint16_t profile_now(void)
+{
+	uint32_t primask = __get_PRIMASK();
+	uint16_t now;
+
+	__disable_irq();
+	NRF_TIMER2->TASKS_CAPTURE[3] = 1;
+	now = NRF_TIMER2->CC[3];
+	__set_PRIMASK(primask);
+	return now;
+}
+
+#endif
+
+#ifdef PROFILE
+
+extern uint16_t profile_start[PROFILE_STAGES];
+
+void profile_record(uint8_t stage, uint16_t start);
+
+#define PROFILE_BEGIN(stage)	(profile_start[stage] = profile_now())
+#define PROFILE_END(stage)	profile_record(stage, profile_start[stage])
+
+#else
+
+#define PROFILE_BEGIN(stage)	do {} while (0)
+#define PROFILE_END(stage)	do {} while (0)
+
+#endif
+
+void profile_dump(void);
+
+#endif // PROFILE_H__
@@ -0,0 +1,216 @@
+#ifndef _log_format_h
+#define _log_format_h
+
+/*------------------------------------------------------------------
+ * flight log format, shared by logging.c and the pc side tools
+ *
+ * the log is written in LOG_BLOCK_SIZE blocks, one flash page each,
+ * LOG_SECTOR_BLOCKS to a 4 KB sector. every block starts with a
+ * header and is self contained: the first record is coded against
+ * zero, the others as the difference to the record before, all as
+ * zig-zag varints, starting with the time step in us.
+ *
+ * schema 2 records hold a selection of channels, each logged every
+ * so many control loop runs: time step, channel mask, mode, then the
+ * fields of the channels in the mask, coded against the last record
+ * in the block that held the channel.
+ *
+ * header (multi byte fields big endian):
+ *   0  magic 'L' 'G'
+ *   2  version
+ *   3  schema, which fields a record holds
+ *   4  flight id (2), the sequence number the flight started at
+ *   6  sector sequence number (4)
+ *  10  time of the first record in us (4)
+ *  14  number of records
+ *  15  payload length
+ *  16  crc16 over the header up to here and the payload (2)
+ *------------------------------------------------------------------
+ */
+
+#include <inttypes.h>
+#include "protocol.h"
+
+#define LOG_AREA_SIZE			0x1E000	// then a sector of reset records and one of scratch space for flash_benchmark()
+#define LOG_BLOCK_SIZE			256
+#define LOG_SECTOR_SIZE			4096
+#define LOG_SECTOR_BLOCKS		(LOG_SECTOR_SIZE / LOG_BLOCK_SIZE)
+#define LOG_BLOCK_HEADER_SIZE		18
+#define LOG_BLOCK_PAYLOAD		(LOG_BLOCK_SIZE - LOG_BLOCK_HEADER_SIZE)
+
+#define LOG_MAGIC_0			'L'
+#define LOG_MAGIC_1			'G'
+#define LOG_VERSION			2
+
+#define LOG_OFS_VERSION			2
+#define LOG_OFS_SCHEMA			3
+#define LOG_OFS_FLIGHT			4
+#define LOG_OFS_SEQ			6
+#define LOG_OFS_TIME			10
+#define LOG_OFS_COUNT			14
+#define LOG_OFS_LENGTH			15
+#define LOG_OFS_CRC			16
+
+// schema 1: mode, bat_volt, pressure, sp, sq, sr, phi, theta, psi
+#define LOG_SCHEMA_FLIGHT		1
+#define LOG_SCHEMA_FLIGHT_FIELDS	9
+
+// schema 2: a record holds the channels in its mask
+#define LOG_SCHEMA_CHANNELS		2
+
+// capture blocks hold the samples around a trigger, at the full
+// control loop rate, as schema 2 records. the low bits are the trigger
+#define LOG_SCHEMA_CAPTURE		0x80
+#define LOG_TRIGGER_PANIC		1
+#define LOG_TRIGGER_BATTERY		2
+#define LOG_TRIGGER_LINK		3
+#define LOG_TRIGGER_ATTITUDE		4
+#define LOG_TRIGGER_COMMAND		5
+
+#define LOG_CH_GYRO			0	// sp, sq, sr
+#define LOG_CH_ACCEL			1	// sax, say, saz
+#define LOG_CH_ATTITUDE			2	// phi, theta, psi
+#define LOG_CH_MOTORS			3	// ae[0..3]
+#define LOG_CH_CONTROL			4	// lift_force, roll_moment, pitch_moment, yaw_moment, p_ctrl
+#define LOG_CH_BARO			5	// pressure, temperature
+#define LOG_CH_BATTERY			6	// bat_volt
+#define LOG_CH_LINK			7	// frames received, checksum errors, rx and tx queue overruns
+#define LOG_CHANNELS			8
+#define LOG_CHANNEL_VALUES		25	// fields of all channels together
+
+#define LOG_CHANNEL_NAMES		{"gyro", "accel", "attitude", "motors", "control", "baro", "battery", "link"}
+#define LOG_CSV_HEADER			"flight,time_us,mode,sp,sq,sr,sax,say,saz,phi,theta,psi,ae0,ae1,ae2,ae3," \
+					"lift_force,roll_moment,pitch_moment,yaw_moment,p_ctrl,pressure,temperature,bat_volt," \
+					"rx_frames,rx_errors,rx_overruns,tx_overruns,capture\n"
+
+#define LOG_VARINT_MAX			5	// bytes for 32 bits
+
+// crc of a block as stored in its header
+static inline uint16_t log_block_crc(const uint8_t *block)
+{
+	uint16_t crc = crc16_update(0xFFFF, block, LOG_OFS_CRC);
+
+	return crc16_update(crc, block + LOG_BLOCK_HEADER_SIZE, block[LOG_OFS_LENGTH]);
+}
+
+static inline uint32_t zigzag_encode(int32_t v)
+{
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t zigzag_decode(uint32_t v)
+{
+	return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+// 7 bits per byte, least significant first, MSB set on all but the last
+static inline int varint_put(uint8_t *p, uint32_t v)
+{
+	int n = 0;
+
+	while (v >= 0x80)
+	{
+		p[n++] = (v & 0x7F) | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+// returns the bytes used, 0 if the varint runs past len
+static inline int varint_get(const uint8_t *p, int len, uint32_t *v)
+{
+	int n = 0, shift = 0;
+
+	*v = 0;
+	while (n < len && n < LOG_VARINT_MAX)
+	{
+		*v |= (uint32_t)(p[n] & 0x7F) << shift;
+		if ((p[n++] & 0x80) == 0)
+			return n;
+		shift += 7;
+	}
+	return 0;
+}
+
+// decodes one record into time and v, which hold the previous record
+// unless first. returns the bytes used, 0 if the record is cut short
+static inline int log_decode_record(const uint8_t *p, int len, int fields, int first, uint32_t *time, int32_t *v)
+{
+	uint32_t u;
+	int i, n, pos;
+
+	if ((pos = varint_get(p, len, &u)) == 0)
+		return 0;
+	*time += u;
+	for (i = 0; i < fields; i++)
+	{
+		if ((n = varint_get(p + pos, len - pos, &u)) == 0)
+			return 0;
+		pos += n;
+		v[i] = (first ? 0 : v[i]) + zigzag_decode(u);
+	}
+	return pos;
+}
+
+static inline int log_channel_fields(int channel)
+{
+	switch (channel)
+	{
+	case LOG_CH_MOTORS:
+	case LOG_CH_LINK:
+		return 4;
+	case LOG_CH_CONTROL:
+		return 5;
+	case LOG_CH_BARO:
+		return 2;
+	case LOG_CH_BATTERY:
+		return 1;
+	default:
+		return 3;
+	}
+}
+
+// decodes one schema 2 record. v holds the fields of all channels in
+// channel order, the last values seen in the block, and must start
+// out zero for every block. returns the bytes used, 0 if the record
+// is cut short
+static inline int log_decode_channels(const uint8_t *p, int len, uint32_t *time, uint8_t *mask, uint8_t *mode, int32_t *v)
+{
+	uint32_t u;
+	int ch, i, n, pos;
+
+	if ((pos = varint_get(p, len, &u)) == 0 || pos + 2 > len)
+		return 0;
+	*time += u;
+	*mask = p[pos++];
+	*mode = p[pos++];
+	for (ch = 0; ch < LOG_CHANNELS; ch++)
+	{
+		for (i = 0; i < log_channel_fields(ch); i++, v++)
+		{
+			if ((*mask & (1 << ch)) == 0)
+				continue;
+			if ((n = varint_get(p + pos, len - pos, &u)) == 0)
+				return 0;
+			pos += n;
+			*v += zigzag_decode(u);
+		}
+	}
+	return pos;
+}
+
+static inline void put_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static inline uint32_t get_be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+#endif
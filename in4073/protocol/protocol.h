@@ -3,6 +3,12 @@
 
 /* protcol header file, JMI  */
 
+#include <inttypes.h>
+
+// serial link speed, must match on both sides.
+// the nRF51 UART also does 230400, 460800, 921600 and 1000000
+#define LINK_BAUDRATE			115200
+
 // mode
 #define SAFE_MODE               0x00
 #define PANIC_MODE              0x01
@@ -36,6 +42,150 @@ typedef struct {
 	char checksum;
 } packet;
 
-packet pc_packet;
+extern packet pc_packet;
+
+/*------------------------------------------------------------------
+ * framing
+ *
+ * every frame starts with a header byte that has its MSB set, all
+ * other bytes are 7 bit. uplink frames are all PACKET_SIZE long.
+ * downlink frames are interleaved with the printf text (plain
+ * ascii), a byte with the MSB set starts a frame whose length
+ * follows from its header. the last byte of a frame is the
+ * checksum, computed like get_checksum() over the rest.
+ *------------------------------------------------------------------
+ */
+#define PACKET_SIZE			8
+
+// uplink
+#define PING_HEADER			0x81	// seq, ground time (4), spare
+#define CMD_HEADER			0x82	// command, argument (4), spare
+
+// commands, only acted upon in safe mode
+#define CMD_FLASH_BENCH			0x01	// erase, write and read back a flash sector, print the throughput
+#define CMD_LOG_STATUS			0x02	// print the flight log counters
+#define CMD_LOG_DUMP			0x03	// stream the log as DUMP frames, argument: first seq << 21 | flash address
+#define CMD_LOG_DUMP_ACK		0x04	// DUMP frames received in order since the (re)start
+#define CMD_LOG_LIST			0x05	// print the flights in the log
+#define CMD_LOG_SELECT			0x06	// limit CMD_LOG_DUMP to the next older flight, or all after the oldest
+#define CMD_LOG_CHANNEL			0x07	// argument: channel << 8 | log every n control loop runs, 0 is off
+#define CMD_LOG_TRIGGER			0x08	// capture the samples around now, as a crash would
+#define CMD_MODE_TRACE			0x09	// print the last mode transitions
+#define CMD_SCHED_STATUS		0x0A	// print the task and interrupt counters and start a new window
+#define CMD_PROFILE_DUMP		0x0B	// send a PROFILE frame per stage and start over
+
+// downlink
+#define PONG_HEADER			0x81	// seq, ground time (4), rx frames (2), checksum errors (2), rx overruns (2), cpu load (2)
+#define PONG_SIZE			15
+#define DUMP_HEADER			0x82	// seq, flash address (3), data (DUMP_DATA bytes packed in septets), crc (2)
+#define DUMP_DATA			28
+#define DUMP_OFS_CRC			37
+#define DUMP_SIZE			40
+#define DUMP_END_ADDRESS		0x1FFFFF	// address of the last DUMP frame, no data
+#define PROFILE_HEADER			0x83	// stage, count (3), min us (3), max us (3), total us (5), histogram (PROFILE_BUCKETS x 2)
+#define PROFILE_BUCKETS			16	// bucket k counts times of 2^k to 2^(k+1) - 1 us, the first from 0
+#define PROFILE_OFS_HISTOGRAM		16
+#define PROFILE_SIZE			(PROFILE_OFS_HISTOGRAM + 2 * PROFILE_BUCKETS + 1)
+
+// stages of the control loop timed by a -DPROFILE build
+#define PROFILE_SENSOR_READ		0	// imu fifo over i2c
+#define PROFILE_DECODE			1	// dmp packet to gyro, accel and quaternion
+#define PROFILE_EULER			2	// quaternion to phi, theta, psi
+#define PROFILE_FILTER			3
+#define PROFILE_CONTROL			4
+#define PROFILE_MIXER			5	// forces and moments to ae[]
+#define PROFILE_MOTORS			6	// ae[] to the motor timer
+#define PROFILE_PARSER			7	// uplink frames out of the rx queue
+#define PROFILE_TELEMETRY		8	// flight log record
+#define PROFILE_STAGES			9
+#define PROFILE_STAGE_NAMES		{"sensor read", "decode", "euler", "filter", "control", "mixer", "motors", "parser", "telemetry"}
+
+#define PING_TIME_MASK			0x0FFFFFFF	// ground time is echoed as 28 bits of us
+
+static inline uint8_t frame_checksum(const uint8_t *frame, int len)
+{
+	uint8_t x = 0;
+	int i;
+
+	for (i = 0; i < len - 1; i++)
+		x ^= frame[i];
+	return (x >> 1) & 0x7F;
+}
+
+static inline uint16_t crc16_update(uint16_t crc, const uint8_t *p, int len)
+{
+	int i;
+
+	// CCITT, polynomial 0x1021, start with 0xFFFF
+	while (len--)
+	{
+		crc ^= (uint16_t)*p++ << 8;
+		for (i = 0; i < 8; i++)
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+// the checksum misses two flips of the same bit, which a log dump is
+// long enough to run into. its frames carry 14 bits of crc as well
+static inline uint16_t dump_frame_crc(const uint8_t *frame)
+{
+	return crc16_update(0xFFFF, frame, DUMP_OFS_CRC) & 0x3FFF;
+}
+
+// store/load v as n 7 bit bytes, most significant first
+static inline void put_septets(uint8_t *p, uint32_t v, int n)
+{
+	while (n--)
+	{
+		p[n] = v & 0x7F;
+		v >>= 7;
+	}
+}
+
+static inline uint32_t get_septets(const uint8_t *p, int n)
+{
+	uint32_t v = 0;
+
+	while (n--)
+		v = (v << 7) | (*p++ & 0x7F);
+	return v;
+}
+
+// 8 bit data as septets, 7 bytes in 8: the top bits of the 7 first, then the low 7 bits of each.
+// n must be a multiple of 7
+static inline void pack_septets(uint8_t *p, const uint8_t *data, int n)
+{
+	int i;
+
+	for (; n > 0; n -= 7, data += 7, p += 8)
+	{
+		p[0] = 0;
+		for (i = 0; i < 7; i++)
+		{
+			p[0] |= (data[i] >> 7) << i;
+			p[i + 1] = data[i] & 0x7F;
+		}
+	}
+}
+
+static inline void unpack_septets(uint8_t *data, const uint8_t *p, int n)
+{
+	int i;
+
+	for (; n > 0; n -= 7, data += 7, p += 8)
+		for (i = 0; i < 7; i++)
+			data[i] = (p[i + 1] & 0x7F) | (((p[0] >> i) & 1) << 7);
+}
+
+// one-shot command frame
+static inline void make_command_frame(uint8_t *frame, uint8_t command, uint32_t argument)
+{
+	frame[0] = CMD_HEADER;
+	frame[1] = command & 0x7F;
+	put_septets(&frame[2], argument, 4);
+	frame[6] = 0;
+	frame[PACKET_SIZE-1] = frame_checksum(frame, PACKET_SIZE);
+}
 
 #endif
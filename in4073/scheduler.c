@@ -0,0 +1,236 @@
+/*------------------------------------------------------------------
+ *  scheduler.c -- cooperative task scheduler
+ *
+ *  tasks are added with a priority, a period and a deadline.
+ *  sched_run(), called from the idle loops, first runs the events
+ *  interrupts left in the app_scheduler queue and then the one due
+ *  task of highest priority, so a task waits for at most one run of
+ *  a task below it. a task with period 0 is due whenever nothing
+ *  above it is, for background work.
+ *
+ *  with nothing due the cpu sleeps until the next interrupt, TIMER2
+ *  is set to give one at the next release. the uart, the imu, the
+ *  adc and the motor timers wake it as well. a period 0 task keeps
+ *  it from sleeping at all.
+ *
+ *  a run that ends more than the deadline after the release, or a
+ *  release that passes without a run, counts as a miss. the time
+ *  spent in each task and asleep is added up for sched_report(),
+ *  the time awake over the last second is sched_cpu_load().
+ *
+ *  jmi
+ *------------------------------------------------------------------
+ */
+
+#include "in4073.h"
+#include "nrf_soc.h"
+#include "app_scheduler.h"
+
+#define SCHED_EVENT_SIZE	sizeof(uint16_t)
+#define SCHED_QUEUE_SIZE	4
+#define SCHED_MIN_SLEEP_US	20	// not worth going to sleep for less
+#define SCHED_LOAD_WINDOW_US	1000000
+
+typedef struct {
+	const char *name;
+	void (*run)(void);
+	uint8_t priority;
+	uint32_t period_us;
+	uint32_t deadline_us;		// 0 for none
+	uint32_t release_us;
+	uint32_t runs;
+	uint32_t misses;
+	uint32_t max_us;		// longest run
+	uint32_t busy_us;		// time in the task since the last report
+} sched_task_t;
+
+//sorted on priority, highest first
+static sched_task_t sched_tasks[SCHED_TASKS_MAX];
+static uint8_t sched_count;
+static uint64_t sched_since_us;
+static uint32_t sched_idle_us;		// asleep since the last report
+
+//cpu load over the last whole second
+static uint32_t sched_load_start_us;
+static uint32_t sched_load_idle_us;
+static uint16_t sched_load;		// per mille
+
+void sched_init(void)
+{
+	APP_SCHED_INIT(SCHED_EVENT_SIZE, SCHED_QUEUE_SIZE);
+	sched_count = 0;
+	sched_since_us = now_us64();
+	sched_idle_us = 0;
+	sched_load_start_us = get_time_us();
+	sched_load_idle_us = 0;
+	sched_load = 0;
+}
+
+/**
+ * Adds a periodic task, first released one period from now.
+ *
+ * @param priority SCHED_CONTROL is the highest.
+ * @param period_us 0 runs the task whenever no other task is due.
+ * @param deadline_us after the release, 0 for none.
+ * @return
+ * @retval false if the table is full.
+ */
+bool sched_add(const char *name, void (*run)(void), uint8_t priority, uint32_t period_us, uint32_t deadline_us)
+{
+	sched_task_t *t;
+	int i;
+
+	if (sched_count == SCHED_TASKS_MAX)
+	{
+		return false;
+	}
+	for (i = sched_count; i > 0 && sched_tasks[i-1].priority > priority; i--)
+	{
+		sched_tasks[i] = sched_tasks[i-1];
+	}
+	t = &sched_tasks[i];
+	t->name = name;
+	t->run = run;
+	t->priority = priority;
+	t->period_us = period_us;
+	t->deadline_us = deadline_us;
+	t->release_us = get_time_us() + period_us;
+	t->runs = 0;
+	t->misses = 0;
+	t->max_us = 0;
+	t->busy_us = 0;
+	sched_count++;
+	return true;
+}
+
+/* sleeps until an interrupt, at the latest at wake_us */
+static void sched_sleep(uint32_t wake_us)
+{
+	uint32_t start, slept;
+
+	timer_wake_at(wake_us);
+	start = get_time_us();
+	if ((int32_t)(wake_us - start) < SCHED_MIN_SLEEP_US)
+	{
+		return;
+	}
+	if (sd_app_evt_wait() == NRF_ERROR_SOFTDEVICE_NOT_ENABLED)
+	{
+		//an interrupt taken since the last sleep makes this return at once
+		__WFE();
+	}
+	slept = get_time_us() - start;
+	sched_idle_us += slept;
+	sched_load_idle_us += slept;
+}
+
+static void sched_update_load(uint32_t now)
+{
+	uint32_t window = now - sched_load_start_us;
+
+	if (window < SCHED_LOAD_WINDOW_US)
+	{
+		return;
+	}
+	sched_load = (window - sched_load_idle_us) / (window / 1000);
+	sched_load_start_us = now;
+	sched_load_idle_us = 0;
+}
+
+/* time awake over the last second, in per mille */
+uint16_t sched_cpu_load(void)
+{
+	return sched_load;
+}
+
+void sched_run(void)
+{
+	sched_task_t *t = 0;
+	uint32_t now, start, used, late, wake;
+	int i;
+
+	app_sched_execute();
+	watchdog_supervise();
+
+	now = get_time_us();
+	sched_update_load(now);
+	wake = now + SCHED_LOAD_WINDOW_US;
+	for (i = 0; i < sched_count; i++)
+	{
+		t = &sched_tasks[i];
+		if ((int32_t)(now - t->release_us) >= 0)
+		{
+			break;
+		}
+		if ((int32_t)(t->release_us - wake) < 0)
+		{
+			wake = t->release_us;
+		}
+	}
+	if (i == sched_count)
+	{
+		sched_sleep(wake);
+		return;
+	}
+
+	start = get_time_us();
+	t->run();
+	now = get_time_us();
+
+	used = now - start;
+	t->runs++;
+	t->busy_us += used;
+	if (used > t->max_us)
+	{
+		t->max_us = used;
+	}
+	if (t->deadline_us != 0 && now - t->release_us > t->deadline_us)
+	{
+		t->misses++;
+	}
+
+	if (t->period_us == 0)
+	{
+		t->release_us = now;
+		return;
+	}
+	t->release_us += t->period_us;
+	late = now - t->release_us;
+	if ((int32_t)late >= 0 && late >= t->period_us)
+	{
+		//releases that went by while the task waited are not made up
+		t->misses += late / t->period_us;
+		t->release_us += late / t->period_us * t->period_us;
+	}
+}
+
+/*------------------------------------------------------------------
+ * prints the counters of each task and the share of the time spent
+ * in it since the last report, then starts a new window
+ *------------------------------------------------------------------
+ */
+void sched_report(void)
+{
+	sched_task_t *t;
+	uint64_t now = now_us64();
+	uint32_t window = now - sched_since_us;
+	int i;
+
+	printf("SCHED: %u tasks, %lu ms since the last report, %lu.%lu%% asleep, load %u.%u%% over the last second\n",
+		sched_count, window / 1000, (uint32_t)((uint64_t)sched_idle_us * 100 / window),
+		(uint32_t)((uint64_t)sched_idle_us * 1000 / window % 10), sched_load / 10, sched_load % 10);
+	for (i = 0; i < sched_count; i++)
+	{
+		t = &sched_tasks[i];
+		printf("SCHED: %-9s prio %u period %6lu us runs %6lu misses %4lu max %5lu us cpu %3lu.%lu%%\n",
+			t->name, t->priority, t->period_us, t->runs, t->misses, t->max_us,
+			(uint32_t)((uint64_t)t->busy_us * 100 / window), (uint32_t)((uint64_t)t->busy_us * 1000 / window % 10));
+		t->runs = 0;
+		t->misses = 0;
+		t->max_us = 0;
+		t->busy_us = 0;
+		nrf_delay_ms(6);
+	}
+	sched_idle_us = 0;
+	sched_since_us = now_us64();
+}
@@ -4,56 +4,67 @@ int calculate_L(char roll);
 int calculate_M(char pitch);
 int calculate_N(char yaw);
 void calculate_rpm(int Z, int L, int M, int N);
-void calibration_mode();
-void manual_mode();
-void safe_mode();
-void panic_mode();
-void calibration_mode();
-void yaw_control_mode();
+uint8_t calibration_mode();
+uint8_t manual_mode();
+uint8_t safe_mode();
+uint8_t panic_mode();
+uint8_t yaw_control_mode();
 void check_connection();
 void process_input();
 
-//state pointer
-void (*statefunc)();
+//state machine, events 0 to MODES-1 ask for that mode
+#define MODES			9
+#define EVENT_LINK_LOST		9
+#define EVENT_BATTERY_LOW	10
+#define EVENT_DONE		11	// a state has run its course
+#define EVENTS			12
+#define EVENT_NONE		0xFF
+void fsm_step(void);
+void fsm_event(uint8_t event);
+void fsm_raise(uint8_t event);
+bool fsm_event_pending(void);
+void fsm_report(void);
+bool fsm_has_control(void);
+void control_task(void);
 
-//variable to hold current mode
-char cur_mode;
+//variable to hold current mode, the state
+extern char cur_mode;
 
 //p controller value
-char p_ctrl;
+extern char p_ctrl;
 
 //variable to hold current movement
-char cur_lift;
-char cur_pitch;
-char cur_roll;
-char cur_yaw;
+extern char cur_lift;
+extern char cur_pitch;
+extern char cur_roll;
+extern char cur_yaw;
 
 //variable to hold old movement
-char old_lift;
-char old_pitch;
-char old_roll;
-char old_yaw;
+extern char old_lift;
+extern char old_pitch;
+extern char old_roll;
+extern char old_yaw;
 
 //force and moments in drone
-int lift_force;
-int roll_moment;
-int pitch_moment;
-int yaw_moment;
+extern int lift_force;
+extern int roll_moment;
+extern int pitch_moment;
+extern int yaw_moment;
 
 //dc offset of gyro sensor
-int16_t p_off;
-int16_t q_off;
-int16_t r_off;
+extern int16_t p_off;
+extern int16_t q_off;
+extern int16_t r_off;
 
 //counters to take care of exiting when communication breaks down
-uint32_t time_latest_packet_us, current_time_us;
+extern uint32_t time_latest_packet_us, current_time_us;
 
 //flags indicating that there is still connection and battery
-bool connection;
-bool battery;
+extern bool connection;
+extern bool battery;
 
 //flag indicating that a new message has arrived
-bool msg;
+extern bool msg;
 
 //flag to print in safe mode
-bool safe_print;
+extern bool safe_print;
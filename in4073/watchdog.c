@@ -0,0 +1,192 @@
+/*------------------------------------------------------------------
+ *  watchdog.c -- hardware watchdog and its supervisor
+ *
+ *  the control task, the sensor pipeline and the link task check in
+ *  with watchdog_checkin(). watchdog_supervise(), called on each
+ *  pass of the scheduler, only feeds the WDT while each of them has
+ *  checked in within its deadline, so a hung i2c transfer or a state
+ *  that never finishes resets the drone WDT_CONFIG_RELOAD_VALUE ms
+ *  later, and the motors stop with it.
+ *
+ *  the channels that were late when the supervisor stopped feeding
+ *  are kept in GPREGRET, which survives the reset. at boot the reset
+ *  reason and those channels go to a record in the flash sector
+ *  between the log and the benchmark scratch sector and are printed.
+ *
+ *  jmi
+ *------------------------------------------------------------------
+ */
+
+#include "in4073.h"
+#include "app_util_platform.h"
+#include "nrf_drv_wdt.h"
+#include "protocol/log_format.h"
+
+#define RESET_RECORD_ADDRESS	LOG_AREA_SIZE	// the sector after the log area
+#define RESET_RECORD_SECTOR	LOG_SECTOR_SIZE
+#define RESET_RECORD_MAGIC	0x5A
+
+typedef struct {
+	uint8_t magic;
+	uint8_t late;		// channels late before a watchdog reset
+	uint16_t boot;
+	uint32_t reason;	// RESETREAS, 0 for power on
+} reset_record_t;
+
+static const uint32_t watchdog_deadline_us[WATCHDOG_CHANNELS] = {
+	[WATCHDOG_CONTROL]	= 20000,
+	[WATCHDOG_SENSORS]	= 50000,
+	[WATCHDOG_LINK]		= 50000,
+};
+static const char *const watchdog_names[WATCHDOG_CHANNELS] = {"control", "sensors", "link"};
+
+static uint32_t watchdog_seen_us[WATCHDOG_CHANNELS];
+static nrf_drv_wdt_channel_id watchdog_channel;
+static bool watchdog_running;
+
+/* stops the motors in the few cycles before the reset */
+static void watchdog_expired(void)
+{
+	nrf_gpio_pin_clear(MOTOR_0_PIN);
+	nrf_gpio_pin_clear(MOTOR_1_PIN);
+	nrf_gpio_pin_clear(MOTOR_2_PIN);
+	nrf_gpio_pin_clear(MOTOR_3_PIN);
+}
+
+/*------------------------------------------------------------------
+ * appends a record for this boot to the reset sector. the sector is
+ * erased when it is full, or when it holds anything but records
+ *------------------------------------------------------------------
+ */
+static void record_reset(uint32_t reason, uint8_t late)
+{
+	reset_record_t r;
+	uint32_t address;
+	uint16_t boot = 0;
+
+	for (address = RESET_RECORD_ADDRESS; address < RESET_RECORD_ADDRESS + RESET_RECORD_SECTOR; address += sizeof(r))
+	{
+		if (!flash_read_cached(address, (uint8_t *)&r, sizeof(r)))
+		{
+			printf("RESET: cannot read the records\n");
+			return;
+		}
+		if (r.magic == 0xFF)
+		{
+			break;
+		}
+		if (r.magic != RESET_RECORD_MAGIC)
+		{
+			address = RESET_RECORD_ADDRESS + RESET_RECORD_SECTOR;
+			break;
+		}
+		boot = r.boot + 1;
+	}
+	if (address >= RESET_RECORD_ADDRESS + RESET_RECORD_SECTOR)
+	{
+		address = RESET_RECORD_ADDRESS;
+		if (!flash_sector_erase(address))
+		{
+			printf("RESET: cannot erase the record sector\n");
+			return;
+		}
+	}
+
+	r.magic = RESET_RECORD_MAGIC;
+	r.late = late;
+	r.boot = boot;
+	r.reason = reason;
+	if (!flash_write_bytes(address, (uint8_t *)&r, sizeof(r)))
+	{
+		printf("RESET: cannot write the record\n");
+	}
+
+	printf("RESET: boot %u,%s%s%s%s%s%s", boot, reason == 0 ? " power on" : "",
+		reason & POWER_RESETREAS_RESETPIN_Msk ? " pin" : "",
+		reason & POWER_RESETREAS_DOG_Msk ? " watchdog" : "",
+		reason & POWER_RESETREAS_SREQ_Msk ? " software" : "",
+		reason & POWER_RESETREAS_LOCKUP_Msk ? " lockup" : "",
+		reason & POWER_RESETREAS_OFF_Msk ? " wake up" : "");
+	if (reason & POWER_RESETREAS_DOG_Msk)
+	{
+		printf(", late:%s%s%s%s", late & (1 << WATCHDOG_CONTROL) ? " control" : "",
+			late & (1 << WATCHDOG_SENSORS) ? " sensors" : "",
+			late & (1 << WATCHDOG_LINK) ? " link" : "",
+			late == 0 ? " none, the scheduler stopped" : "");
+	}
+	printf("\n");
+}
+
+/* records why we came out of reset and starts the WDT, between
+ * spi_flash_init() and log_init(), while the flash is idle */
+void watchdog_init(void)
+{
+	uint32_t reason = NRF_POWER->RESETREAS;
+	uint8_t late = NRF_POWER->GPREGRET;
+	nrf_drv_wdt_config_t config = NRF_DRV_WDT_DEAFULT_CONFIG;
+	int i;
+
+	//the bits stay set until written 1
+	NRF_POWER->RESETREAS = reason;
+	NRF_POWER->GPREGRET = 0;
+	record_reset(reason, late);
+
+	for (i = 0; i < WATCHDOG_CHANNELS; i++)
+	{
+		watchdog_seen_us[i] = get_time_us();
+	}
+	if (nrf_drv_wdt_init(&config, watchdog_expired) != NRF_SUCCESS ||
+		nrf_drv_wdt_channel_alloc(&watchdog_channel) != NRF_SUCCESS)
+	{
+		printf("RESET: no watchdog\n");
+		return;
+	}
+	nrf_drv_wdt_enable();
+	watchdog_running = true;
+}
+
+void watchdog_checkin(uint8_t channel)
+{
+	watchdog_seen_us[channel] = get_time_us();
+}
+
+void watchdog_supervise(void)
+{
+	uint32_t now = get_time_us();
+	uint8_t late = 0;
+	int i;
+
+	if (!watchdog_running)
+	{
+		return;
+	}
+	for (i = 0; i < WATCHDOG_CHANNELS; i++)
+	{
+		if (now - watchdog_seen_us[i] > watchdog_deadline_us[i])
+		{
+			late |= 1 << i;
+		}
+	}
+	if (late != NRF_POWER->GPREGRET)
+	{
+		NRF_POWER->GPREGRET = late;
+	}
+	if (late == 0)
+	{
+		nrf_drv_wdt_channel_feed(watchdog_channel);
+	}
+}
+
+/* prints the channels and how long ago each checked in */
+void watchdog_report(void)
+{
+	uint32_t now = get_time_us();
+	int i;
+
+	printf("WATCHDOG: %s", watchdog_running ? "running" : "off");
+	for (i = 0; i < WATCHDOG_CHANNELS; i++)
+	{
+		printf(", %s %lu us ago (%lu)", watchdog_names[i], now - watchdog_seen_us[i], watchdog_deadline_us[i]);
+	}
+	printf("\n");
+}